@@ -1,29 +1,303 @@
+#define _FILE_OFFSET_BITS 64 // 64 bit off_t for ftello and fseeko on 32 bit systems too
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CHECKSUM_HARDWARE // SSE4.2 crc32, used when the processor has it
+#endif
 
 #include "ht.h"
 
 #define HTSIZE 512
-#define BYTEMAX 256
+#define BYTEMAX HT_BYTEVALUES
+#define IOBUFSIZE 65536   // size of the bulk read/write buffers
+#define DECODE_ROOTBITS 11 // bits indexing the primary decode table
+#define MAXCODELEN 32      // longest code that fits in HuffmanNode::hcode
+#define DECODE_FIXEDSUB (BYTEMAX << (HT_MAXCODELEN - DECODE_ROOTBITS)) // sub table entries of any code up to HT_MAXCODELEN
+#define COUNT_CHUNK (1 << 30)      // bytes counted before the 32 bit histograms are merged
+#define COUNT_PARALLEL_MIN (1 << 24) // smallest span worth counting on several threads
+#define COUNT_MAXTHREADS 64
+#define POOL_MAXTHREADS 256
+#define DRIVER_IOBUFSIZE (1 << 20) // stdio buffer of the files written by the drivers
+#define PIPE_SLOTS 4               // buffers in flight between two pipeline stages
+#define PIPE_BUFSIZE (1 << 18)     // bytes per pipeline buffer
+#define PIPE_SPINS 64              // yields before a waiting pipeline stage starts to sleep
+#define PIPE_SLEEPNS 50000         // sleep of a pipeline stage that has waited longer
+#define PIPE_MINSIZE (4 * PIPE_BUFSIZE) // smallest input worth two more threads and the pipeline's buffers
+#define CHECKSUM_POLY 0x82F63B78   // CRC-32C (Castagnoli) polynomial, bit reflected
+#define CHECKSUM_LANESIZE 32768    // bytes per lane of the hardware CRC, long enough to pay for joining them
+
+// Block container written by WriteBlocksToFile
+#define FORMAT_MAGIC "HTB"     // first bytes of a block container
+#define FORMAT_VERSION 2
+#define FORMAT_HEADERSIZE 16   // magic, version, block size, original size
+#define BLOCK_HUFFMAN 0        // block coded with its own canonical code
+#define BLOCK_HUFFMAN4 1       // same, with the block split in 4 streams that are decoded in step
+#define BLOCK_RAW 2            // block stored as it is, for bytes the codes would not shrink
+#define BLOCK_RLE 3            // block of one repeated byte, stored as that byte
+#define BLOCK_END 0xFF         // marks the end of the blocks
+#define BLOCK_CHECKED 0x80     // type bit of a block whose payload starts with the CRC-32C of its data
+#define BLOCK_HEADERSIZE 9     // type, raw size, payload size
+#define BLOCK_CHECKSIZE 4      // CRC-32C of a BLOCK_CHECKED block
+#define BLOCK_STREAMS 4        // streams of a BLOCK_HUFFMAN4 block
+#define BLOCK_JUMPSIZE 12      // sizes of the first 3 streams of a BLOCK_HUFFMAN4 block
+#define BLOCK_BOUND(rawsize) (BLOCK_HEADERSIZE + BLOCK_CHECKSIZE + LENGTHS_MAXSIZE + BLOCK_JUMPSIZE + (rawsize) + 8)
+#define INDEX_MAGIC "HTBI"     // last bytes of a container that ends in a block index
+#define INDEX_ENTRYSIZE 16     // offset, size, raw size
+#define INDEX_TRAILERSIZE 8    // block count, magic
+#define INDEX_WINDOW 4         // blocks per worker read and decoded at a time from an indexed container
+
+// Forms of the code length header written by WriteCompressedTreeToFile
+#define LENGTHS_PACKED 0  // 32 byte presence bitmap, then a nibble per present symbol
+#define LENGTHS_RLE 1     // run length coded lengths for all BYTEMAX symbols
+#define LENGTHS_MAXSIZE (1 + BYTEMAX)
 
 #pragma region Private Structs
 
-/// @brief Struct to track frequency of value and if the value has been seen
+/// @brief A slice of a span for one thread of the parallel histogram
+typedef struct
+{
+    const unsigned char *data;
+    size_t len;
+    uint64_t counts[BYTEMAX];
+} CountJob;
+
+/// @brief Code of one symbol, indexed directly by the symbol value
+typedef struct
+{
+    unsigned int hcode;       // the code, first bit in the LSB
+    unsigned char codelength; // length of the code in bits
+    bool present;             // false if the symbol has no leaf in the tree
+} EncodeEntry;
+
+/// @brief Single producer, single consumer ring of buffers between two pipeline stages. The producer
+/// fills the slot at tail and the consumer drains the slot at head, each writing only its own index,
+/// so neither takes a lock. A slot of length 0 ends the data
+typedef struct
+{
+    unsigned char *slots[PIPE_SLOTS];
+    size_t lengths[PIPE_SLOTS];
+    _Atomic size_t head, tail; // slots drained and filled so far
+    atomic_bool closed;        // set by the consumer when it stops draining before the end
+} PipeQueue;
+
+/// @brief File coding split in three stages that overlap: a reader thread fills in, the calling thread
+/// codes from in to out, and a writer thread drains out
+typedef struct
+{
+    PipeQueue in, out;
+    FILE *input, *output;
+    uint64_t toread;         // bytes left for the reader stage to read
+    atomic_bool failed;      // set by the reader stage when the input fails, which ends the data early
+    pthread_t reader, writer;
+} Pipeline;
+
+/// @brief Packs codes LSB first into a 64 bit buffer and flushes whole words to a large output buffer
+typedef struct
+{
+    uint64_t bits;         // pending bits, oldest bit in the LSB
+    unsigned int count;    // number of pending bits
+    unsigned char *buffer; // output bytes
+    size_t len, cap;       // fill and size of buffer
+    FILE *output;          // stream the buffer is flushed to when full, NULL to only write to buffer
+    Pipeline *pipe;        // pipeline whose out queue the full buffer is handed to, NULL if none
+    bool overflow;         // set if the bits did not fit in a buffer with no stream behind it
+} BitWriter;
+
+/// @brief One slot of the table driven decoder
+typedef struct
+{
+    unsigned int value;     // decoded symbol, or offset of the sub table if subbits != 0
+    unsigned char length;   // length of the code in bits, 0 if no code maps here
+    unsigned char subbits;  // number of bits that index the sub table, 0 for direct slots
+} DecodeEntry;
+
+/// @brief Lookup tables that decode the next code from the bottom bits of a bit buffer
+typedef struct DecodeTable
+{
+    DecodeEntry primary[1 << DECODE_ROOTBITS]; // indexed by the next DECODE_ROOTBITS bits
+    DecodeEntry *sub;                          // sub tables for the longer codes, back to back
+    unsigned int subcapacity;                  // entries allocated for sub
+    unsigned char maxlength;                   // longest code in the table
+    bool ready;                                // false once the tree's codes have changed
+    bool fixed;                                // sub is caller storage that can not grow
+} DecodeTable;
+
+/// @brief Reads the compressed bit stream LSB first into a 64 bit buffer, refilling in bulk
+typedef struct
+{
+    uint64_t bits;               // buffered bits, next bit in the LSB
+    unsigned int count;          // number of valid bits in bits
+    const unsigned char *buffer; // data bytes, the whole stream when reading from memory
+    size_t pos, len;             // position and fill of buffer
+    FILE *input;                 // stream buffer is refilled from, NULL when reading from memory
+    Pipeline *pipe;              // pipeline whose in queue buffer is refilled from, NULL if none
+    unsigned char *storage;      // allocation behind buffer when reading from input
+    uint64_t remaining;          // data bytes not yet read from input
+    unsigned char lastbits;      // valid bits in the final data byte, 0 if all 8 are valid
+} BitReader;
+
+/// @brief Numbers gathered while coding blocks, summed into an HTStats when a call ends
+typedef struct
+{
+    uint64_t histogramns, buildns, headerns, codens, checksumns;
+    uint64_t blocks, tables;
+    uint64_t symbols, coded;   // bytes of the blocks before and after coding, block headers included
+    uint64_t codebits;         // bits of the codes alone
+    uint64_t codes, lengthsum; // symbols present in the blocks' tables and their code lengths summed
+    double entropybits;        // order 0 entropy of each block times its size, summed
+    unsigned char maxlength;
+} BlockStats;
+
+/// @brief One block travelling through the worker pool
+typedef struct
+{
+    const unsigned char *in; // bytes to code
+    size_t inlen;
+    unsigned char *out;      // where the coded bytes go
+    size_t outcap, outlen;
+    unsigned int flags;      // HT_ flags the block is compressed with
+    int status;              // 0 once coded, -1 if coding failed
+    bool done;
+    bool measure;            // gather stats of the jobs run in this slot
+    BlockStats stats;        // summed over every job run in this slot
+} BlockJob;
+
+/// @brief Where one block of a container is and what it decodes to
 typedef struct
 {
-    bool seen;
-    int frequency;
-} SymbolReader;
+    uint64_t offset;    // from the start of the container to the block header
+    uint64_t rawoffset; // of the block's bytes in the decompressed data, not stored
+    uint32_t size;      // of the block including its header
+    uint32_t rawsize;
+} BlockIndexEntry;
 
-/// @brief Stores nodes in a way optimal for compression
+/// @brief Codes a block with the given worker owned tree
+typedef void (*BlockFunction)(BlockJob *job, HuffmanTree *ht);
+
+/// @brief Fixed set of threads that code queued blocks, each with its own reusable tree
 typedef struct
 {
-    // saves 12 bytes per node
-    unsigned char value;
-    unsigned int hcode;
-    unsigned char codelength;
-} CompressedNode;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;     // a job was queued, or the pool is stopping
+    pthread_cond_t finished; // a job is done
+    BlockJob **queue;        // ring of queued jobs
+    size_t head, queued, capacity;
+    BlockFunction run;
+    HuffmanTree *local;      // tree for jobs run on the calling thread when there are no workers
+    pthread_t threads[POOL_MAXTHREADS];
+    int nthreads;
+    bool stopping;
+} BlockPool;
+
+// Shared code tables for small messages
+#define DICT_MAGIC "HTD"       // first bytes of a saved dictionary
+#define DICT_VERSION 1
+#define DICT_HEADERSIZE 8      // magic, version, id
+#define DICT_CODED 0xD0        // message coded with the dictionary's table
+#define DICT_STORED 0xD1       // message stored as is, for messages the table would not shrink
+#define DICT_TRAINBITS 30      // sample counts are scaled down to fit this many bits before smoothing
+
+// Containers of 16 bit symbols made by CompressHTWide
+#define WIDE_MAGIC "HTW"       // first bytes of a wide container
+#define WIDE_VERSION 1
+#define WIDE_HEADERSIZE 16     // magic, version, alphabet, element count
+#define WIDE_BLOCKSIZE (1 << 19) // elements per block, 1 MB of input
+#define WIDE_MAXCODELEN 20     // longest code, room for every alphabet up to HT_MAXALPHABET
+#define WIDE_LENGTHBITS 5      // bits per code length in a block's lengths header
+
+// States of an HTStream
+#define STREAM_HEADER 0    // gathering the container header
+#define STREAM_BLOCK 1     // compressing: gathering input. decompressing: gathering a block header
+#define STREAM_LENGTHS 2   // gathering the code lengths of a single stream block
+#define STREAM_CODES 3     // decoding the codes of a single stream block as they arrive
+#define STREAM_PAYLOAD 4   // gathering a whole block other than a BLOCK_HUFFMAN block
+#define STREAM_SKIP 5      // skipping the rest of a block's payload
+#define STREAM_INDEX 6     // skipping the index entries
+#define STREAM_TRAILER 7   // gathering the index trailer
+#define STREAM_DONE 8
+
+/// @brief Code table trained once and shared by every message that names its id. Read only once made,
+/// so one dictionary can serve any number of threads
+struct HTDictionary
+{
+    uint32_t id;
+    unsigned char lengths[BYTEMAX]; // code length of every byte value, none 0
+    EncodeEntry encoder[BYTEMAX];
+    HuffmanTree *ht;                // owns the decode tables
+    const DecodeTable *decoder;
+};
+
+/// @brief Codes of an alphabet of up to HT_MAXALPHABET symbols, sized once and reused for every block.
+/// Only the entries of the symbols present in a block are touched, so a block of a few distinct values
+/// costs about what it does with bytes however large the alphabet
+struct HTWide
+{
+    unsigned int alphabet;  // symbols are below this
+    uint32_t *counts;       // alphabet entries, zero except at the symbols in present
+    uint16_t *present;      // symbols of the current block
+    unsigned int npresent;
+    uint64_t *sorted;       // count << 16 | symbol of the present symbols, then their code lengths
+    uint64_t *scratch;      // second buffer of the radix sort of sorted
+    EncodeEntry *encoder;   // alphabet entries, set for the symbols of the current block
+    DecodeTable decoder;
+};
+
+/// @brief Incremental codec context. The whole container, down to the bits of a partly decoded code,
+/// persists between calls to FeedHTStream
+struct HTStream
+{
+    bool compress;
+    unsigned int flags;           // HT_ flags of the blocks compressed
+    int state;                    // STREAM_ state
+    size_t blocksize;
+    HuffmanTree *ht;              // reused for every block
+    unsigned char header[FORMAT_HEADERSIZE]; // container, block or trailer header being gathered, the container's is the largest
+    size_t headerlen;
+    unsigned char *block;         // compressing: input of the block. decompressing: a gathered block
+    size_t blocklen;
+    unsigned char *pending;       // bytes waiting for room in the output
+    size_t pendingpos, pendinglen, pendingcap;
+    BlockIndexEntry *index;       // compressing: the blocks written so far
+    uint32_t nblocks, indexcap;
+    uint64_t offset;              // compressing: bytes of the container made so far
+    uint64_t rawsize, rawtotal;   // decompressing: original size from the header, and the raw sizes of the blocks so far
+    const DecodeTable *table;     // decompressing: tables of the current block
+    uint64_t bits;                // decompressing: buffered bits of the current block, next bit in the LSB
+    unsigned int count;           // number of valid bits in bits
+    size_t payloadleft;           // bytes of the current block's payload not yet taken from the input
+    size_t remaining;             // symbols of the current block not yet decoded
+    size_t skip;                  // bytes left to skip in STREAM_SKIP and STREAM_INDEX
+    unsigned char stage[LENGTHS_MAXSIZE]; // code lengths of a single stream block and the first codes after them
+    size_t stagepos, stagelen;
+    uint64_t started;             // time of the first call on this container while a stats hook is set, else 0
+    uint64_t bytesin, bytesout;   // taken and produced by every call on this container
+    BlockStats stats;
+};
+
+// Set by SetHTStatsHook, NULL while no stats are gathered
+static HTStatsHook statsHook = NULL;
+static void *statsUser = NULL;
+
+// CRC-32C slicing tables and the routine for this processor, set up once by InitChecksum
+static pthread_once_t checksumOnce = PTHREAD_ONCE_INIT;
+static uint32_t checksumTable[8][BYTEMAX];
+static uint32_t checksumLaneShift; // x^(8 CHECKSUM_LANESIZE), moves a CRC past a lane
+static uint32_t (*checksumUpdate)(uint32_t crc, const unsigned char *data, size_t len);
 
 #pragma endregion Private Structs
 
@@ -37,9 +311,8 @@ typedef struct
 /// @return 1 if N1 > N2, -1 if N1 < N2, 0 if N1 == N2
 int CompareNodes(const void *node1, const void *node2)
 {
-    /// @todo I think this could be simpler, pointers wise
-    HuffmanNode *N1 = *((HuffmanNode **)node1);
-    HuffmanNode *N2 = *((HuffmanNode **)node2);
+    const HuffmanNode *N1 = (const HuffmanNode *)node1;
+    const HuffmanNode *N2 = (const HuffmanNode *)node2;
 
     if (N1->frequency > N2->frequency)
         return 1;
@@ -49,63 +322,6 @@ int CompareNodes(const void *node1, const void *node2)
         return 0;
 }
 
-/// @brief Append a singular bit to all of the huffman codes below the parent node [RECURSIVE]
-/// @param parent The parent node to append below
-/// @param appendbit The bit (0 or 1) to append to the huffman codes
-/// @return 0 upon success
-int UpdateHCodesBelow(HuffmanNode *parent, int appendbit)
-{
-    if (parent->left == NULL && parent->right == NULL)
-    {
-        return 0;
-    }
-    else
-    {
-        if (appendbit) // append a 1 to the hcodes
-        {
-            parent->left->hcode = (parent->left->hcode << 1) | 0x00000001;
-            parent->right->hcode = (parent->right->hcode << 1) | 0x00000001;
-        }
-        else // append a 0 to the hcodes
-        {
-            parent->left->hcode = (parent->left->hcode << 1) & 0xFFFFFFFE;
-            parent->right->hcode = (parent->right->hcode << 1) & 0xFFFFFFFE;
-        }
-        parent->left->codelength++;
-        parent->right->codelength++;
-
-        // recurse with the same appendature
-        UpdateHCodesBelow(parent->left, appendbit);
-        UpdateHCodesBelow(parent->right, appendbit);
-    }
-    return 0;
-}
-
-/// @brief Reverse the order of the bottom n bits in an integer
-/// @param reverse The integer to reverse
-/// @param n Number of bits to reverse
-/// @return the reversed number
-unsigned int ReverseLowerNBits(unsigned int num, unsigned int n)
-{
-    /// @todo Make this entire function unneeded
-    unsigned int result = 0;
-    unsigned int mask = (1U << n) - 1; // Mask for the lower N bits
-    // First, isolate the lower N bits
-    unsigned int lowerBits = num & mask;
-    // Reverse the lower N bits
-    for (int i = 0; i < n; i++)
-    {
-        // If the i-th bit from right is set in original number
-        if (lowerBits & (1U << i))
-        {
-            // Set the (n-1-i)-th bit in result
-            result |= (1U << (n - 1 - i));
-        }
-    }
-    // Clear the lower N bits in the original number and add the reversed bits
-    return (num & ~mask) | result;
-}
-
 /// @brief Gets the index into ht->tree for the given symbol value
 /// @param ht The huffman tree to search through
 /// @param value Tee value (byte symbol) to find
@@ -115,7 +331,7 @@ int GetCodeFromCharacter(HuffmanTree *ht, unsigned char value)
     /// @todo Make this more efficient (Start at top of tree? Binary search?)
     for (int i = 0; i < ht->count; i++)
     {
-        if (ht->tree[i]->value == value && ht->tree[i]->left == NULL && ht->tree[i]->right == NULL)
+        if (ht->tree[i].value == value && ht->tree[i].left == HT_NONE)
         {
             return i;
         }
@@ -134,486 +350,4773 @@ int GetCharacterFromCode(HuffmanTree *ht, unsigned int code, unsigned char len)
     for (int i = 0; i < ht->count; i++)
     {
         // if the value and the length is correct
-        if (ht->tree[i]->hcode == code && ht->tree[i]->codelength == len)
+        if (ht->tree[i].hcode == code && ht->tree[i].codelength == len)
         { // and there are no left/right children (it is a symbol node)
-            if (ht->tree[i]->left == NULL && ht->tree[i]->right == NULL)
+            if (ht->tree[i].left == HT_NONE)
             {
-                return ht->tree[i]->value;
+                return ht->tree[i].value;
             }
         }
     }
     return -1;
 }
 
-#pragma endregion Utilities
-
-#pragma region InitFree
-
-/// @brief Initializes huffman tree object
-/// @return pointer to huffman tree, or NULL on failure
-HuffmanTree *InitHT()
+/// @brief Reverses the order of the bottom len bits of a code, all higher bits are dropped
+/// @param code The code to reverse
+/// @param len Number of bits in the code
+/// @return the reversed code
+unsigned int ReverseBits(unsigned int code, unsigned char len)
 {
-    HuffmanTree *ht = (HuffmanTree *)calloc(1, sizeof(HuffmanTree));
-    if (ht == NULL)
-    {
-        return NULL;
-    }
-    /// @todo Unroll this loop for performance
-    // set all values to null
-    for (int i = 0; i < HTSIZE; i++)
+    unsigned int result = 0;
+    for (int i = 0; i < len; i++)
     {
-        ht->tree[i] = NULL;
+        result = (result << 1) | (code & 1);
+        code >>= 1;
     }
-
-    return ht;
+    return result;
 }
 
-HuffmanTree *InitHTLight()
+/// @brief Replaces the codes of the symbol nodes with canonical codes of the same lengths. Codes are
+/// handed out in order of length, then symbol value, so the lengths alone are enough to rebuild them
+/// @param ht The huffman tree whose symbol nodes have their code lengths set
+/// @return 0 if successful, -1 if a code is longer than MAXCODELEN
+int AssignCanonicalCodes(HuffmanTree *ht)
 {
-    HuffmanTree *ht = (HuffmanTree *)calloc(1, sizeof(HuffmanTree));
-    if (ht == NULL)
+    HuffmanNode *symbols[BYTEMAX] = {NULL};
+    unsigned int lengthcount[MAXCODELEN + 1] = {0};
+    uint64_t nextcode[MAXCODELEN + 1];
+    uint64_t code = 0;
+
+    for (int i = 0; i < ht->count; i++)
     {
-        return NULL;
+        HuffmanNode *node = &ht->tree[i];
+        if (node->left == HT_NONE)
+        {
+            if (node->codelength > MAXCODELEN)
+                return -1;
+            symbols[node->value] = node;
+            lengthcount[node->codelength]++;
+        }
     }
-    return ht;
-}
 
-/// @brief Frees all memory associated with the huffmane tree
-/// @param ht huffman tree to free
-/// @return if successful, 0, if failed -1
-int FreeHT(HuffmanTree *ht)
-{
-    if (ht == NULL)
+    // first code of each length follows on from the last code of the length before
+    lengthcount[0] = 0;
+    for (int len = 1; len <= MAXCODELEN; len++)
     {
-        printf("Cannot free null tree!\n");
-        return -1;
+        code = (code + lengthcount[len - 1]) << 1;
+        nextcode[len] = code;
     }
-    /// @todo Unroll loop for performance
-    for (int i = 0; i < ht->count; i++)
+
+    for (int value = 0; value < BYTEMAX; value++)
     {
-        free(ht->tree[i]);
+        HuffmanNode *node = symbols[value];
+        if (node == NULL || node->codelength == 0)
+            continue;
+        // codes are written first bit first, so the MSB of the canonical code goes in the LSB
+        node->hcode = ReverseBits((unsigned int)nextcode[node->codelength]++, node->codelength);
     }
-    free(ht);
     return 0;
 }
 
-#pragma endregion InitFree
-
-#pragma region Debug
-
-/// @brief Prints basic tree information
-/// @param ht Tree to print from
-/// @param opening String used to set an opening preamble to tree info
-void PrintTreeInformation(HuffmanTree *ht, const char *opening)
+/// @brief Packs the code length of every symbol into the smaller of the two header forms
+/// @param lengths Code length of each of the BYTEMAX symbols, 0 if absent
+/// @param out Buffer of at least LENGTHS_MAXSIZE bytes
+/// @return number of bytes written to out
+int PackCodeLengths(const unsigned char *lengths, unsigned char *out)
 {
-    printf("%s", opening);
-    printf("Huffman Tree Stats:\n");
-    printf("ByteCount: %u\n", ht->bytecount);
-    printf("Count: %u\n", ht->count);
-    printf("Max Freq: %u\n", ht->maxfreq);
-    if (ht->root == NULL)
+    unsigned char rle[LENGTHS_MAXSIZE];
+    int rlesize = 1, packedsize = 1 + BYTEMAX / 8, present = 0;
+    bool packable = true;
+
+    // run length form: 00LLLLLL a length, 01NNNNNN N+1 more of the last length, 1NNNNNNN N+1 zeros
+    rle[0] = LENGTHS_RLE;
+    for (int i = 0; i < BYTEMAX;)
     {
-        printf("\n");
-        return;
+        int run = 1;
+        if (lengths[i] == 0)
+        {
+            while (i + run < BYTEMAX && lengths[i + run] == 0 && run < 128)
+                run++;
+            rle[rlesize++] = 0x80 | (run - 1);
+            i += run;
+            continue;
+        }
+        rle[rlesize++] = lengths[i];
+        i++;
+        run = 0;
+        while (i + run < BYTEMAX && lengths[i + run] == lengths[i - 1] && run < 64)
+            run++;
+        if (run != 0)
+        {
+            rle[rlesize++] = 0x40 | (run - 1);
+            i += run;
+        }
     }
-    printf("Root Node info:\n");
-    printf("Value: %u\tFrequency: %u\n", ht->root->value, ht->root->frequency);
-    printf("Left Child: %p\tRight Child: %p\n", (void *)ht->root->left, (void *)ht->root->right);
-    printf("\n");
-}
 
-/// @brief Prints the information of all the nodes currently within the tree
-/// @param ht The huffman tree to print
-/// @return if success, 0; if failed, -1
-int PrintNodes(HuffmanTree *ht)
-{
-    if (ht == NULL)
+    for (int i = 0; i < BYTEMAX; i++)
     {
-        printf("Cannot print null tree!\n");
-        return -1;
+        if (lengths[i] > 15)
+            packable = false;
+        if (lengths[i] != 0)
+            present++;
     }
-    int scount = 0;
+    packedsize += (present + 1) / 2;
 
-    printf("Printing tree from root down:\n\n");
-    for (int i = ht->count - 1; i >= 0; i--)
+    if (!packable || rlesize <= packedsize)
     {
-        unsigned int hcode = ht->tree[i]->hcode;
-        printf("Node #%d @ addr: %p\t\tLeft: %p\t\tRight: %p\n", (ht->count - 1) - i, (void *)ht->tree[i], (void *)ht->tree[i]->left, (void *)ht->tree[i]->right);
-        printf("HCode of len %d:\t%u =>\t", ht->tree[i]->codelength, hcode);
-        for (int i = 31; i >= 0; i--)
-        {
-            printf("%u", (hcode >> i) & 0x01);
-            scount++;
-            if (scount == 4)
-            {
-                printf(" ");
-                scount = 0;
-            }
-        }
-        printf("\n");
-        printf("Val: %u/%c   \tFreq: %u\n\n", ht->tree[i]->value, ht->tree[i]->value, ht->tree[i]->frequency);
+        for (int i = 0; i < rlesize; i++)
+            out[i] = rle[i];
+        return rlesize;
     }
-    printf("\n");
 
-    return 0;
+    // packed form: presence bitmap, then the lengths of the present symbols two to a byte
+    out[0] = LENGTHS_PACKED;
+    for (int i = 1; i < packedsize; i++)
+        out[i] = 0;
+    present = 0;
+    for (int i = 0; i < BYTEMAX; i++)
+    {
+        if (lengths[i] == 0)
+            continue;
+        out[1 + i / 8] |= 1 << (i % 8);
+        out[1 + BYTEMAX / 8 + present / 2] |= lengths[i] << ((present % 2) * 4);
+        present++;
+    }
+    return packedsize;
 }
 
-int PrintNode(HuffmanTree *ht, int index, const char *opening)
+/// @brief Unpacks a header written by PackCodeLengths
+/// @param in The packed header
+/// @param avail Number of bytes available in in
+/// @param lengths Receives the code length of each of the BYTEMAX symbols
+/// @return number of bytes the header took up, or -1 if it is malformed or truncated
+int UnpackCodeLengths(const unsigned char *in, size_t avail, unsigned char *lengths)
 {
-    if (index > 511 || index >= ht->count)
-    {
+    size_t pos = 1;
+    int filled = 0, present = 0;
+
+    if (avail < 1)
         return -1;
-    }
-    int scount = 0;
 
-    unsigned int hcode = ht->tree[index]->hcode;
-    printf("%s", opening);
-    printf("Node of index %d @ addr: %p\t\tLeft: %p\t\tRight: %p\n", index, (void *)ht->tree[index], (void *)ht->tree[index]->left, (void *)ht->tree[index]->right);
-    printf("HCode of len %d:\t%u =>\t", ht->tree[index]->codelength, hcode);
-    for (int i = 31; i >= 0; i--)
+    if (in[0] == LENGTHS_PACKED)
     {
-        printf("%u", (hcode >> i) & 0x01);
-        scount++;
-        if (scount == 4)
+        pos += BYTEMAX / 8;
+        if (avail < pos)
+            return -1;
+        for (int i = 0; i < BYTEMAX; i++)
         {
-            printf(" ");
-            scount = 0;
+            lengths[i] = 0;
+            if (in[1 + i / 8] & (1 << (i % 8)))
+            {
+                if (avail < pos + present / 2 + 1)
+                    return -1;
+                lengths[i] = (in[pos + present / 2] >> ((present % 2) * 4)) & 0x0F;
+                present++;
+            }
         }
+        return (int)(pos + (present + 1) / 2);
     }
-    printf("\n");
-    printf("Val: %u   \tFreq: %u\n\n", ht->tree[index]->value, ht->tree[index]->frequency);
-    return 0;
+    else if (in[0] == LENGTHS_RLE)
+    {
+        unsigned char last = 0;
+        while (filled < BYTEMAX)
+        {
+            if (pos >= avail)
+                return -1;
+            unsigned char op = in[pos++];
+            int run = 1;
+            unsigned char len;
+            if (op & 0x80)
+            {
+                run = (op & 0x7F) + 1;
+                len = 0;
+            }
+            else if (op & 0x40)
+            {
+                run = (op & 0x3F) + 1;
+                len = last;
+            }
+            else
+            {
+                len = op;
+                if (len > MAXCODELEN)
+                    return -1;
+            }
+            if (filled + run > BYTEMAX)
+                return -1;
+            for (int i = 0; i < run; i++)
+                lengths[filled++] = len;
+            last = len;
+        }
+        return (int)pos;
+    }
+    return -1;
 }
 
-void HTFailure()
+/// @brief Stores a 32 bit value little endian
+/// @param out Where to store the 4 bytes
+/// @param value The value to store
+void PutU32(unsigned char *out, uint32_t value)
 {
+    out[0] = (unsigned char)value;
+    out[1] = (unsigned char)(value >> 8);
+    out[2] = (unsigned char)(value >> 16);
+    out[3] = (unsigned char)(value >> 24);
 }
 
-#pragma endregion Debug
+/// @brief Loads a little endian 32 bit value
+/// @param in The 4 bytes to load
+/// @return the value
+uint32_t GetU32(const unsigned char *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
 
-#pragma region Compression
+/// @brief Stores a 64 bit value little endian
+/// @param out Where to store the 8 bytes
+/// @param value The value to store
+void PutU64(unsigned char *out, uint64_t value)
+{
+    PutU32(out, (uint32_t)value);
+    PutU32(out + 4, (uint32_t)(value >> 32));
+}
 
-/// @brief Traverses through a file and counts the number of each byte. Resets input stream to start of file
-/// @param inputFile The pointer to the input file stream
-/// @param FreqTable Table of 256 unsigned ints
-/// @return 0 if successful
-int InitializeLeafNodes(FILE *inputFile, HuffmanTree *ht)
+/// @brief Loads a little endian 64 bit value
+/// @param in The 8 bytes to load
+/// @return the value
+uint64_t GetU64(const unsigned char *in)
 {
-    unsigned char symbol;
-    SymbolReader symbolTable[BYTEMAX];
+    return (uint64_t)GetU32(in) | ((uint64_t)GetU32(in + 4) << 32);
+}
 
-    if (inputFile == NULL || ht == NULL)
-    {
-        printf("%p\t%p\n", inputFile, ht);
+/// @brief Stores a value 7 bits per byte, low bits first, the top bit of a byte set if more follow
+/// @param out Where to store the value, room for 10 bytes
+/// @param value The value to store
+/// @return number of bytes stored
+int PutVarint(unsigned char *out, uint64_t value)
+{
+    int n = 0;
 
-        printf("Cannot parse for null file or tree!\n");
-        return -1;
-    }
-    /// @todo Unroll for performance
-    for (int i = 0; i < BYTEMAX; i++)
-    {
-        symbolTable[i].seen = false;
-        symbolTable[i].frequency = 0;
-    }
-    // First pass: just count symbols and then update table
-    while (fread(&symbol, sizeof(unsigned char), 1, inputFile))
+    while (value >= 0x80)
     {
-        if (!symbolTable[symbol].seen)
-        {
-            symbolTable[symbol].seen = true;
-        }
-        symbolTable[(unsigned int)symbol].frequency++;
-        ht->bytecount++;
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
     }
-    ht->count = 0;
+    out[n++] = (unsigned char)value;
+    return n;
+}
 
-    /// @todo Unroll for performance
-    for (int character = 0; character < BYTEMAX; character++)
+/// @brief Loads a value stored by PutVarint
+/// @param in The stored bytes
+/// @param avail Number of bytes available
+/// @param value Set to the value
+/// @return number of bytes used, or -1 if the value is cut short or longer than 64 bits
+int GetVarint(const unsigned char *in, size_t avail, uint64_t *value)
+{
+    *value = 0;
+    for (int n = 0; n < 10 && (size_t)n < avail; n++)
     {
-        // if the symbol was seen
-        if (symbolTable[character].seen)
-        {
-            // init one leaf node
-            ht->tree[ht->count] = (HuffmanNode *)calloc(1, sizeof(HuffmanNode)); // init
-            ht->tree[ht->count]->value = (unsigned char)character;
-            ht->tree[ht->count]->frequency = symbolTable[character].frequency;
-            ht->tree[ht->count]->left = NULL;
-            ht->tree[ht->count]->right = NULL;
-            ht->tree[ht->count]->hcode = 0;
-            ht->tree[ht->count]->codelength = 0;
-            ht->count++;
-
-            // Check if max
-            if (symbolTable[character].frequency > ht->maxfreq)
-            {
-                ht->maxfreq = symbolTable[character].frequency;
-            }
-        }
+        *value |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+        if ((in[n] & 0x80) == 0)
+            return n + 1;
     }
-    rewind(inputFile); // rewind to start of fp
-    return 0;
+    return -1;
 }
 
-/// @brief Given tree with initialized symbols, builds tree and sets root node
-/// @param ht The huffman tree object to build the tree within
-/// @return 0 if successful, -1 if determined root frequency does not match size of file
-int BuildHTFromFrequencies(HuffmanTree *ht)
-{
-    unsigned int numInternalNodes = 0, numLeafNodes = ht->count, numNodesProcessed = 0;
-
-    /// @todo Can make this more efficient with min heap and not need to sort each time.
-    qsort(ht->tree, ht->count, sizeof(HuffmanNode *), CompareNodes); // qsort each of the leaf nodes to sort from min to max freqs
+#pragma endregion Utilities
 
-    while (numInternalNodes < (numLeafNodes - 1))
-    {
-        // grab the two lowest freq nodes
-        HuffmanNode *leftNode = ht->tree[numNodesProcessed];
-        HuffmanNode *rightNode = ht->tree[numNodesProcessed + 1];
+#pragma region Stats
 
-        // Insert a node at the end of the tree with frequency as the sum of the two children
-        HuffmanNode *parentNode = (HuffmanNode *)calloc(1, sizeof(HuffmanNode));
-        parentNode->left = leftNode;
-        parentNode->right = rightNode;
-        parentNode->frequency = leftNode->frequency + rightNode->frequency;
-        ht->tree[ht->count + numInternalNodes] = parentNode;
-
-        leftNode->hcode = (leftNode->hcode << 1) & 0xFFFFFFFE;
-        rightNode->hcode = (rightNode->hcode << 1) | 0x00000001;
-        leftNode->codelength++;
-        rightNode->codelength++;
-        UpdateHCodesBelow(leftNode, 0);
-        UpdateHCodesBelow(rightNode, 1);
+/// @brief Reads the monotonic clock
+/// @return time in nanoseconds
+uint64_t GetTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-        numInternalNodes++;
-        numNodesProcessed += 2;
+/// @brief Time since the last lap, without reading the clock when no stats are gathered
+/// @param stats Where the caller gathers stats, NULL if none
+/// @param mark Time of the last lap, moved to now
+/// @return nanoseconds since the last lap, 0 without stats
+uint64_t Lap(const BlockStats *stats, uint64_t *mark)
+{
+    if (stats == NULL)
+        return 0;
+    uint64_t now = GetTimeNs(), elapsed = now - *mark;
+    *mark = now;
+    return elapsed;
+}
 
-        qsort(&ht->tree[numNodesProcessed], ht->count - numInternalNodes, sizeof(HuffmanNode *), CompareNodes);
-    }
+/// @brief Base 2 logarithm, to about 6 digits, so entropy needs no libm
+/// @param x A count, at least 1
+/// @return log2(x)
+double Log2(uint64_t x)
+{
+    int exponent = 0;
+    while (x >> exponent > 1)
+        exponent++;
+    // x = 2^exponent * m with m in [1, 2), and ln(m) = 2 atanh((m - 1) / (m + 1))
+    double m = (double)x / (double)((uint64_t)1 << exponent), y = (m - 1) / (m + 1), y2 = y * y;
+    double ln = 2 * y * (1 + y2 * (1.0 / 3 + y2 * (1.0 / 5 + y2 * (1.0 / 7 + y2 * (1.0 / 9 + y2 / 11)))));
+    return exponent + ln * 1.4426950408889634;
+}
 
-    ht->count += numInternalNodes;
-    ht->root = ht->tree[ht->count - 1];
+/// @brief Order 0 entropy of the symbols counted in a tree's leaves
+/// @param ht The tree, with its symbol nodes counted
+/// @return the fewest bits any code built from the counts can take
+double EntropyBits(const HuffmanTree *ht)
+{
+    double bits = ht->bytecount == 0 ? 0 : ht->bytecount * Log2(ht->bytecount);
 
-    if (ht->root->frequency == ht->bytecount)
-    {
-        return 0;
-    }
-    else
+    for (unsigned int i = 0; i < ht->count; i++)
     {
-        return -1;
+        const HuffmanNode *node = &ht->tree[i];
+        if (node->left == HT_NONE && node->frequency != 0)
+            bits -= node->frequency * Log2(node->frequency);
     }
+    return bits < 0 ? 0 : bits;
 }
 
-int WriteCompressedTreeToFile(HuffmanTree *ht, FILE *output)
+/// @brief Adds the code lengths of a block's table to the stats
+/// @param stats The stats
+/// @param lengths Code length of every byte value, 0 if absent
+void AddTableStats(BlockStats *stats, const unsigned char *lengths)
 {
-    unsigned int nodeCount = 0;
-    CompressedNode hnodes[BYTEMAX];
-    /// @todo Unroll for performance
-    for (int i = 0; i < ht->count; i++)
+    for (int value = 0; value < BYTEMAX; value++)
     {
-        if (ht->tree[i]->left == NULL && ht->tree[i]->right == NULL)
-        {
-            hnodes[nodeCount].value = ht->tree[i]->value;
-            hnodes[nodeCount].hcode = ht->tree[i]->hcode;
-            hnodes[nodeCount].codelength = ht->tree[i]->codelength;
-            nodeCount++;
-        }
+        if (lengths[value] == 0)
+            continue;
+        stats->codes++;
+        stats->lengthsum += lengths[value];
+        if (lengths[value] > stats->maxlength)
+            stats->maxlength = lengths[value];
     }
-    fwrite(&nodeCount, sizeof(unsigned int), 1, output);
-    fwrite(&hnodes, sizeof(CompressedNode), nodeCount, output);
+    stats->tables++;
+}
 
-    return 0;
+/// @brief Sums the stats of some blocks into a total
+/// @param total The total
+/// @param stats The stats to add
+void MergeStats(BlockStats *total, const BlockStats *stats)
+{
+    total->histogramns += stats->histogramns;
+    total->buildns += stats->buildns;
+    total->headerns += stats->headerns;
+    total->codens += stats->codens;
+    total->checksumns += stats->checksumns;
+    total->blocks += stats->blocks;
+    total->tables += stats->tables;
+    total->symbols += stats->symbols;
+    total->coded += stats->coded;
+    total->codebits += stats->codebits;
+    total->codes += stats->codes;
+    total->lengthsum += stats->lengthsum;
+    total->entropybits += stats->entropybits;
+    if (stats->maxlength > total->maxlength)
+        total->maxlength = stats->maxlength;
 }
 
-int WriteTreeToFile(HuffmanTree *ht, FILE *output)
+/// @brief Hands the stats of a finished call to the stats hook, if one is set
+/// @param compress true for a compression
+/// @param stats The stats of the call's blocks
+/// @param bytesin Bytes the call took
+/// @param bytesout Bytes the call produced
+/// @param start Time the call started
+void ReportStats(bool compress, const BlockStats *stats, uint64_t bytesin, uint64_t bytesout, uint64_t start)
 {
-    // Write the huffman tree to the file so that it can be used on decode
-    fwrite(ht, sizeof(HuffmanTree), 1, output);
+    HTStatsHook hook = statsHook;
+    HTStats report = {0};
 
-    /// @todo Unroll for performance
-    for (int i = 0; i < ht->count; i++)
+    if (hook == NULL)
+        return;
+    report.compress = compress;
+    report.bytesin = bytesin;
+    report.bytesout = bytesout;
+    report.blocks = stats->blocks;
+    report.tables = stats->tables;
+    report.histogramns = stats->histogramns;
+    report.buildns = stats->buildns;
+    report.headerns = stats->headerns;
+    report.codens = stats->codens;
+    report.checksumns = stats->checksumns;
+    report.totalns = GetTimeNs() - start;
+    if (stats->symbols != 0)
     {
-        fwrite(ht->tree[i], sizeof(HuffmanNode), 1, output);
+        report.entropy = stats->entropybits / stats->symbols;
+        report.bitspersymbol = (double)stats->codebits / stats->symbols;
     }
-
-    return 0;
+    report.maxcodelength = stats->maxlength;
+    report.avgcodelength = stats->codes == 0 ? 0 : (double)stats->lengthsum / stats->codes;
+    hook(&report, statsUser);
 }
 
-int WriteDataToFile(HuffmanTree *ht, FILE *input, FILE *output)
-{
-    unsigned char inbyte = 0, outbyte = 0, bitsinbyte = 0, thisbytebits = 0;
-    unsigned int hcode = 0, index = 0, counter = 0;
+#pragma endregion Stats
 
-    // read bytes from file
-    while (fread(&inbyte, sizeof(unsigned char), 1, input))
+#pragma region Pipeline
+
+/// @brief Backs off while a pipeline stage waits on its neighbour. It yields at first, then sleeps, so a
+/// stage stalled on slow storage does not hold a processor
+/// @param spins Times waited so far, 0 on the first wait
+void PipeBackoff(unsigned int *spins)
+{
+    if ((*spins)++ < PIPE_SPINS)
+        sched_yield();
+    else
+    {
+        struct timespec pause = {0, PIPE_SLEEPNS};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/// @brief Waits for the slot at the tail of a queue to be free for its producer
+/// @param queue The queue
+/// @return the slot. Once the queue is closed nothing drains it, and the slot is returned without waiting
+unsigned char *GetPipeSlot(PipeQueue *queue)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int spins = 0;
+
+    while (tail - atomic_load_explicit(&queue->head, memory_order_acquire) == PIPE_SLOTS &&
+           !atomic_load_explicit(&queue->closed, memory_order_acquire))
+        PipeBackoff(&spins);
+    return queue->slots[tail % PIPE_SLOTS];
+}
+
+/// @brief Hands the filled slot at the tail of a queue to its consumer
+/// @param queue The queue
+/// @param len Bytes filled, 0 to end the data
+void PushPipeSlot(PipeQueue *queue, size_t len)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    queue->lengths[tail % PIPE_SLOTS] = len;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+/// @brief Waits for the slot at the head of a queue to be filled for its consumer
+/// @param queue The queue
+/// @param len Set to the bytes in the slot, 0 at the end of the data
+/// @return the slot
+const unsigned char *PeekPipeSlot(PipeQueue *queue, size_t *len)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int spins = 0;
+
+    while (atomic_load_explicit(&queue->tail, memory_order_acquire) == head)
+        PipeBackoff(&spins);
+    *len = queue->lengths[head % PIPE_SLOTS];
+    return queue->slots[head % PIPE_SLOTS];
+}
+
+/// @brief Gives the slot at the head of a queue back to its producer
+/// @param queue The queue
+void PopPipeSlot(PipeQueue *queue)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+/// @brief Reader stage: reads the input into the in queue until toread bytes or the end of the input,
+/// then ends the data. A failed read marks the pipeline failed and ends the data there
+/// @param arg The pipeline
+/// @return NULL
+void *PipeReader(void *arg)
+{
+    Pipeline *pipe = (Pipeline *)arg;
+
+    for (;;)
+    {
+        unsigned char *slot = GetPipeSlot(&pipe->in);
+        if (atomic_load(&pipe->in.closed))
+            return NULL;
+        size_t want = pipe->toread < PIPE_BUFSIZE ? (size_t)pipe->toread : PIPE_BUFSIZE;
+        size_t len = want == 0 ? 0 : fread(slot, sizeof(unsigned char), want, pipe->input);
+        if (len < want && ferror(pipe->input))
+        {
+            atomic_store(&pipe->failed, true);
+            len = 0;
+        }
+        pipe->toread -= len;
+        PushPipeSlot(&pipe->in, len);
+        if (len == 0)
+            return NULL;
+    }
+}
+
+/// @brief Writer stage: writes the out queue to the output until the end of the data. A failed write
+/// closes the queue
+/// @param arg The pipeline
+/// @return NULL
+void *PipeWriter(void *arg)
+{
+    Pipeline *pipe = (Pipeline *)arg;
+
+    for (;;)
+    {
+        size_t len;
+        const unsigned char *slot = PeekPipeSlot(&pipe->out, &len);
+        if (len == 0)
+            return NULL;
+        if (fwrite(slot, sizeof(unsigned char), len, pipe->output) != len)
+        {
+            atomic_store(&pipe->out.closed, true);
+            return NULL;
+        }
+        PopPipeSlot(&pipe->out);
+    }
+}
+
+/// @brief Allocates the buffers of a pipeline and starts its reader and writer threads
+/// @param pipe The pipeline to start
+/// @param input The stream the reader stage reads, from where it is
+/// @param output The stream the writer stage writes
+/// @param toread Bytes to read, UINT64_MAX for all of the input
+/// @return 0 if successful, -1 on allocation or thread failure
+int StartPipeline(Pipeline *pipe, FILE *input, FILE *output, uint64_t toread)
+{
+    int status = 0;
+
+    memset(pipe, 0, sizeof(Pipeline));
+    pipe->input = input;
+    pipe->output = output;
+    pipe->toread = toread;
+    for (int i = 0; i < PIPE_SLOTS; i++)
+    {
+        pipe->in.slots[i] = (unsigned char *)malloc(PIPE_BUFSIZE);
+        pipe->out.slots[i] = (unsigned char *)malloc(PIPE_BUFSIZE);
+        if (pipe->in.slots[i] == NULL || pipe->out.slots[i] == NULL)
+            status = -1;
+    }
+    if (status == 0 && pthread_create(&pipe->reader, NULL, PipeReader, pipe) != 0)
+        status = -1;
+    else if (status == 0 && pthread_create(&pipe->writer, NULL, PipeWriter, pipe) != 0)
+    {
+        atomic_store(&pipe->in.closed, true);
+        pthread_join(pipe->reader, NULL);
+        status = -1;
+    }
+    if (status != 0)
+    {
+        for (int i = 0; i < PIPE_SLOTS; i++)
+        {
+            free(pipe->in.slots[i]);
+            free(pipe->out.slots[i]);
+        }
+    }
+    return status;
+}
+
+/// @brief Ends the data of the out queue, waits for the reader and writer stages and frees the pipeline.
+/// The coding stage's output up to here is written even if it failed
+/// @param pipe The pipeline
+/// @param status Result of the coding stage
+/// @return status, or -1 if the reader or writer stage failed
+int StopPipeline(Pipeline *pipe, int status)
+{
+    atomic_store(&pipe->in.closed, true);
+    GetPipeSlot(&pipe->out);
+    PushPipeSlot(&pipe->out, 0);
+    pthread_join(pipe->reader, NULL);
+    pthread_join(pipe->writer, NULL);
+    if (atomic_load(&pipe->out.closed) || atomic_load(&pipe->failed))
+        status = -1;
+    for (int i = 0; i < PIPE_SLOTS; i++)
+    {
+        free(pipe->in.slots[i]);
+        free(pipe->out.slots[i]);
+    }
+    return status;
+}
+
+/// @brief Bytes left in a stream from where it is, to tell whether coding it is worth a pipeline
+/// @param input The stream
+/// @return the bytes left, UINT64_MAX if the stream is not a regular file
+uint64_t GetBytesLeft(FILE *input)
+{
+    struct stat st;
+    off_t pos = ftello(input);
+
+    if (pos < 0 || fstat(fileno(input), &st) != 0 || !S_ISREG(st.st_mode))
+        return UINT64_MAX;
+    return st.st_size > pos ? (uint64_t)(st.st_size - pos) : 0;
+}
+
+#pragma endregion Pipeline
+
+#pragma region Checksum
+
+/// @brief Multiplies two polynomials modulo the CRC-32C polynomial, both bit reflected
+/// @param a First factor, not 0
+/// @param b Second factor
+/// @return the product
+uint32_t MultiplyChecksum(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31, product = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            product ^= b;
+            if ((a & (m - 1)) == 0)
+                return product;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CHECKSUM_POLY : b >> 1;
+    }
+}
+
+/// @brief Runs the CRC-32C register over some bytes 8 at a time with the slicing tables
+/// @param crc The register, inverted CRC of the bytes before these
+/// @param data The bytes
+/// @param len Number of bytes
+/// @return the register after the bytes
+uint32_t UpdateChecksumSoftware(uint32_t crc, const unsigned char *data, size_t len)
+{
+    const uint32_t (*table)[BYTEMAX] = checksumTable;
+
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word)); // little endian, as the bit readers
+        uint32_t low = crc ^ (uint32_t)word, high = (uint32_t)(word >> 32);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+    }
+    for (; len > 0; data++, len--)
+        crc = table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CHECKSUM_HARDWARE
+/// @brief Runs the CRC-32C register over some bytes with the SSE4.2 crc32 instruction. Long runs are split
+/// in 3 lanes of CHECKSUM_LANESIZE bytes whose instructions overlap, and the lanes' CRCs are joined after
+/// @param crc The register, inverted CRC of the bytes before these
+/// @param data The bytes
+/// @param len Number of bytes
+/// @return the register after the bytes
+__attribute__((target("sse4.2"))) uint32_t UpdateChecksumHardware(uint32_t crc, const unsigned char *data, size_t len)
+{
+    uint64_t c0 = crc;
+
+    for (; len >= 3 * CHECKSUM_LANESIZE; data += 3 * CHECKSUM_LANESIZE, len -= 3 * CHECKSUM_LANESIZE)
+    {
+        uint64_t c1 = 0xFFFFFFFF, c2 = 0xFFFFFFFF;
+        for (size_t i = 0; i < CHECKSUM_LANESIZE; i += 8)
+        {
+            uint64_t w0, w1, w2;
+            memcpy(&w0, data + i, sizeof(w0));
+            memcpy(&w1, data + CHECKSUM_LANESIZE + i, sizeof(w1));
+            memcpy(&w2, data + 2 * CHECKSUM_LANESIZE + i, sizeof(w2));
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+        // the CRC of a run followed by a lane is the run's moved past the lane plus the lane's own
+        uint32_t joined = MultiplyChecksum(checksumLaneShift, ~(uint32_t)c0) ^ ~(uint32_t)c1;
+        joined = MultiplyChecksum(checksumLaneShift, joined) ^ ~(uint32_t)c2;
+        c0 = ~joined;
+    }
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        c0 = _mm_crc32_u64(c0, word);
+    }
+    for (; len > 0; data++, len--)
+        c0 = _mm_crc32_u8((uint32_t)c0, *data);
+    return (uint32_t)c0;
+}
+#endif
+
+/// @brief Builds the slicing tables and picks the CRC-32C routine for this processor. Run once
+void InitChecksum(void)
+{
+    uint32_t power = (uint32_t)1 << 30, shift = (uint32_t)1 << 31; // x and 1
+
+    for (unsigned int n = 0; n < BYTEMAX; n++)
+    {
+        uint32_t crc = n;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CHECKSUM_POLY : crc >> 1;
+        checksumTable[0][n] = crc;
+    }
+    for (unsigned int n = 0; n < BYTEMAX; n++)
+        for (int k = 1; k < 8; k++)
+            checksumTable[k][n] = (checksumTable[k - 1][n] >> 8) ^ checksumTable[0][checksumTable[k - 1][n] & 0xFF];
+
+    // x^(8 CHECKSUM_LANESIZE) by squaring, to move a CRC past a lane
+    for (uint64_t n = 8 * (uint64_t)CHECKSUM_LANESIZE; n != 0; n >>= 1)
+    {
+        if (n & 1)
+            shift = MultiplyChecksum(power, shift);
+        power = MultiplyChecksum(power, power);
+    }
+    checksumLaneShift = shift;
+
+    checksumUpdate = UpdateChecksumSoftware;
+#ifdef CHECKSUM_HARDWARE
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        checksumUpdate = UpdateChecksumHardware;
+#endif
+}
+
+/// @brief CRC-32C of some bytes, with the instruction where the processor has it and the tables elsewhere
+/// @param data The bytes
+/// @param len Number of bytes
+/// @return the CRC
+uint32_t GetChecksum(const unsigned char *data, size_t len)
+{
+    pthread_once(&checksumOnce, InitChecksum);
+    return ~checksumUpdate(0xFFFFFFFF, data, len);
+}
+
+#pragma endregion Checksum
+
+#pragma region InitFree
+
+/// @brief Initializes huffman tree object. The nodes live inside the tree, so building it allocates nothing
+/// @return pointer to huffman tree, or NULL on failure
+HuffmanTree *InitHT()
+{
+    HuffmanTree *ht = (HuffmanTree *)calloc(1, sizeof(HuffmanTree));
+    if (ht == NULL)
+    {
+        return NULL;
+    }
+    ht->root = HT_NONE;
+
+    return ht;
+}
+
+/// @brief Empties a tree so it can be built again. Keeps the memory of the decode tables for reuse
+/// @param ht The huffman tree to reset
+void ResetHT(HuffmanTree *ht)
+{
+    ht->bytecount = 0;
+    ht->count = 0;
+    ht->maxfreq = 0;
+    ht->root = HT_NONE;
+    if (ht->decoder != NULL)
+        ht->decoder->ready = false;
+}
+
+/// @brief Frees all memory associated with the huffmane tree
+/// @param ht huffman tree to free
+/// @return if successful, 0, if failed -1
+int FreeHT(HuffmanTree *ht)
+{
+    if (ht == NULL)
+    {
+        printf("Cannot free null tree!\n");
+        return -1;
+    }
+    if (ht->decoder != NULL)
+    {
+        free(ht->decoder->sub);
+        free(ht->decoder);
+    }
+    free(ht);
+    return 0;
+}
+
+#pragma endregion InitFree
+
+#pragma region Debug
+
+/// @brief Prints basic tree information
+/// @param ht Tree to print from
+/// @param opening String used to set an opening preamble to tree info
+void PrintTreeInformation(HuffmanTree *ht, const char *opening)
+{
+    printf("%s", opening);
+    printf("Huffman Tree Stats:\n");
+    printf("ByteCount: %" PRIu64 "\n", ht->bytecount);
+    printf("Count: %u\n", ht->count);
+    printf("Max Freq: %" PRIu64 "\n", ht->maxfreq);
+    if (ht->root == HT_NONE)
+    {
+        printf("\n");
+        return;
+    }
+    printf("Root Node info:\n");
+    printf("Value: %u\tFrequency: %" PRIu64 "\n", ht->tree[ht->root].value, ht->tree[ht->root].frequency);
+    printf("Left Child: %u\tRight Child: %u\n", ht->tree[ht->root].left, ht->tree[ht->root].right);
+    printf("\n");
+}
+
+/// @brief Prints the information of all the nodes currently within the tree
+/// @param ht The huffman tree to print
+/// @return if success, 0; if failed, -1
+int PrintNodes(HuffmanTree *ht)
+{
+    if (ht == NULL)
+    {
+        printf("Cannot print null tree!\n");
+        return -1;
+    }
+    int scount = 0;
+
+    printf("Printing tree from root down:\n\n");
+    for (int i = ht->count - 1; i >= 0; i--)
+    {
+        unsigned int hcode = ht->tree[i].hcode;
+        printf("Node #%d @ index: %d\t\tLeft: %u\t\tRight: %u\n", (ht->count - 1) - i, i, ht->tree[i].left, ht->tree[i].right);
+        printf("HCode of len %d:\t%u =>\t", ht->tree[i].codelength, hcode);
+        for (int i = 31; i >= 0; i--)
+        {
+            printf("%u", (hcode >> i) & 0x01);
+            scount++;
+            if (scount == 4)
+            {
+                printf(" ");
+                scount = 0;
+            }
+        }
+        printf("\n");
+        printf("Val: %u/%c   \tFreq: %" PRIu64 "\n\n", ht->tree[i].value, ht->tree[i].value, ht->tree[i].frequency);
+    }
+    printf("\n");
+
+    return 0;
+}
+
+int PrintNode(HuffmanTree *ht, int index, const char *opening)
+{
+    if (index > 511 || index >= ht->count)
+    {
+        return -1;
+    }
+    int scount = 0;
+
+    unsigned int hcode = ht->tree[index].hcode;
+    printf("%s", opening);
+    printf("Node of index %d\t\tLeft: %u\t\tRight: %u\n", index, ht->tree[index].left, ht->tree[index].right);
+    printf("HCode of len %d:\t%u =>\t", ht->tree[index].codelength, hcode);
+    for (int i = 31; i >= 0; i--)
+    {
+        printf("%u", (hcode >> i) & 0x01);
+        scount++;
+        if (scount == 4)
+        {
+            printf(" ");
+            scount = 0;
+        }
+    }
+    printf("\n");
+    printf("Val: %u   \tFreq: %" PRIu64 "\n\n", ht->tree[index].value, ht->tree[index].frequency);
+    return 0;
+}
+
+void HTFailure()
+{
+}
+
+#pragma endregion Debug
+
+#pragma region Compression
+
+/// @brief Adds the number of times each byte appears in data to counts. Bytes are counted into
+/// four interleaved histograms, so runs of one byte don't stall on the same counter
+/// @param data The bytes to count
+/// @param len Number of bytes
+/// @param counts Table of BYTEMAX counts to add to
+void CountSymbols(const unsigned char *data, size_t len, uint64_t *counts)
+{
+    uint32_t tables[4][BYTEMAX];
+
+    while (len > 0)
+    {
+        size_t chunk = len < COUNT_CHUNK ? len : COUNT_CHUNK, i = 0;
+        memset(tables, 0, sizeof(tables));
+
+        for (; i + 8 <= chunk; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            tables[0][word & 0xFF]++;
+            tables[1][(word >> 8) & 0xFF]++;
+            tables[2][(word >> 16) & 0xFF]++;
+            tables[3][(word >> 24) & 0xFF]++;
+            tables[0][(word >> 32) & 0xFF]++;
+            tables[1][(word >> 40) & 0xFF]++;
+            tables[2][(word >> 48) & 0xFF]++;
+            tables[3][word >> 56]++;
+        }
+        for (; i < chunk; i++)
+            tables[0][data[i]]++;
+
+        for (int v = 0; v < BYTEMAX; v++)
+            counts[v] += (uint64_t)tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+/// @brief Thread body of the parallel histogram
+/// @param arg The CountJob to count
+/// @return NULL
+void *CountSymbolsWorker(void *arg)
+{
+    CountJob *job = (CountJob *)arg;
+    memset(job->counts, 0, sizeof(job->counts));
+    CountSymbols(job->data, job->len, job->counts);
+    return NULL;
+}
+
+/// @brief Scales counts down until their total fits in the given number of bits. Every nonzero count
+/// stays at least 1, so every symbol seen keeps a code
+/// @param counts Table of BYTEMAX counts
+/// @param bits Bits the total must fit in
+void NormalizeCounts(uint64_t *counts, int bits)
+{
+    uint64_t total = 0;
+    int shift = 0;
+
+    for (int value = 0; value < BYTEMAX; value++)
+        total += counts[value];
+    while ((total >> shift) > ((uint64_t)1 << bits))
+        shift++;
+    for (int value = 0; value < BYTEMAX && shift != 0; value++)
+    {
+        if (counts[value] != 0)
+            counts[value] = counts[value] >> shift != 0 ? counts[value] >> shift : 1;
+    }
+}
+
+/// @brief Sets one symbol node per byte value with a nonzero count, and the tree's byte counters.
+/// Counts totalling more than 2^HT_MAXCOUNTBITS are normalized first
+/// @param ht The huffman tree to fill
+/// @param counts Table of BYTEMAX counts
+void LoadLeafNodes(HuffmanTree *ht, const uint64_t *counts)
+{
+    uint64_t scaled[BYTEMAX];
+
+    memcpy(scaled, counts, sizeof(scaled));
+    NormalizeCounts(scaled, HT_MAXCOUNTBITS);
+    counts = scaled;
+    ht->count = 0;
+
+    for (int character = 0; character < BYTEMAX; character++)
+    {
+        // if the symbol was seen
+        if (counts[character] != 0)
+        {
+            // init one leaf node
+            ht->tree[ht->count].value = (unsigned char)character;
+            ht->tree[ht->count].frequency = counts[character];
+            ht->tree[ht->count].left = HT_NONE;
+            ht->tree[ht->count].right = HT_NONE;
+            ht->tree[ht->count].hcode = 0;
+            ht->tree[ht->count].codelength = 0;
+            ht->count++;
+            ht->bytecount += counts[character];
+
+            // Check if max
+            if (counts[character] > ht->maxfreq)
+            {
+                ht->maxfreq = counts[character];
+            }
+        }
+    }
+}
+
+/// @brief Traverses through a file and counts the number of each byte. Resets input stream to where the count started
+/// @param inputFile The pointer to the input file stream
+/// @param ht The huffman tree to set the symbol nodes of
+/// @return 0 if successful, -1 if the stream can not seek back or a read fails
+int InitializeLeafNodes(FILE *inputFile, HuffmanTree *ht)
+{
+    uint64_t counts[BYTEMAX] = {0};
+    unsigned char *buffer;
+    size_t len;
+    off_t start;
+
+    if (inputFile == NULL || ht == NULL)
+    {
+        printf("%p\t%p\n", (void *)inputFile, (void *)ht);
+
+        printf("Cannot parse for null file or tree!\n");
+        return -1;
+    }
+    // the second pass reads the input again from here, so a stream that can not seek is refused up front
+    start = ftello(inputFile);
+    if (start < 0)
+        return -1;
+    buffer = (unsigned char *)malloc(IOBUFSIZE);
+    if (buffer == NULL)
+        return -1;
+
+    // First pass: just count symbols and then update table
+    while ((len = fread(buffer, sizeof(unsigned char), IOBUFSIZE, inputFile)) != 0)
+    {
+        CountSymbols(buffer, len, counts);
+    }
+    free(buffer);
+
+    // a histogram cut short by a read error would leave bytes of the second pass without a code
+    if (ferror(inputFile) || fseeko(inputFile, start, SEEK_SET) != 0)
+        return -1;
+    LoadLeafNodes(ht, counts);
+    return 0;
+}
+
+/// @brief Counts the number of each byte of an in memory span (first pass of compression).
+/// Large spans are split across threads whose histograms are summed at the end
+/// @param data The bytes to count
+/// @param len Number of bytes
+/// @param ht The huffman tree to set the symbol nodes of
+/// @param nthreads Threads to count with, 1 to count on the calling thread only
+/// @return 0 if successful, -1 on a null span or tree
+int InitializeLeafNodesFromMemory(const void *data, size_t len, HuffmanTree *ht, int nthreads)
+{
+    uint64_t counts[BYTEMAX] = {0};
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    if ((data == NULL && len != 0) || ht == NULL)
+    {
+        printf("Cannot parse for null data or tree!\n");
+        return -1;
+    }
+
+    if (nthreads > COUNT_MAXTHREADS)
+        nthreads = COUNT_MAXTHREADS;
+    if (nthreads > 1 && len >= COUNT_PARALLEL_MIN)
+    {
+        CountJob *jobs = (CountJob *)malloc(nthreads * sizeof(CountJob));
+        pthread_t threads[COUNT_MAXTHREADS];
+        int started = 0;
+
+        if (jobs != NULL)
+        {
+            size_t slice = len / nthreads;
+            for (int t = 0; t < nthreads; t++)
+            {
+                jobs[t].data = bytes + t * slice;
+                jobs[t].len = (t == nthreads - 1) ? len - t * slice : slice;
+            }
+            // the calling thread takes the first slice, the rest run alongside it
+            for (started = 1; started < nthreads; started++)
+            {
+                if (pthread_create(&threads[started], NULL, CountSymbolsWorker, &jobs[started]) != 0)
+                    break;
+            }
+            CountSymbolsWorker(&jobs[0]);
+            for (int t = 1; t < started; t++)
+                pthread_join(threads[t], NULL);
+            // slices whose thread could not start are counted here
+            for (int t = started; t < nthreads; t++)
+                CountSymbolsWorker(&jobs[t]);
+
+            for (int t = 0; t < nthreads; t++)
+            {
+                for (int v = 0; v < BYTEMAX; v++)
+                    counts[v] += jobs[t].counts[v];
+            }
+            free(jobs);
+            LoadLeafNodes(ht, counts);
+            return 0;
+        }
+    }
+
+    CountSymbols(bytes, len, counts);
+    LoadLeafNodes(ht, counts);
+    return 0;
+}
+
+/// @brief Sets the symbol nodes from counts gathered elsewhere, such as a frequency list, the same way the
+/// other InitializeLeafNodes functions do from the bytes themselves
+/// @param counts Count of each of the HT_BYTEVALUES byte values
+/// @param ht The huffman tree to set the symbol nodes of, emptied first
+/// @return 0 if successful, -1 on a null table or tree
+int InitializeLeafNodesFromCounts(const uint64_t *counts, HuffmanTree *ht)
+{
+    if (counts == NULL || ht == NULL)
+        return -1;
+    ResetHT(ht);
+    LoadLeafNodes(ht, counts);
+    return 0;
+}
+
+/// @brief Sets the optimal code lengths that are no longer than maxlength, using package-merge.
+/// Each level lists the symbols plus the pairs ("packages") of the level below it, cheapest first;
+/// the cheapest 2n-2 items of the top level give every symbol one bit per level it is picked in
+/// @param leaves The symbol nodes, sorted by increasing frequency
+/// @param n Number of symbol nodes, at least 2 and at most 1 << maxlength
+/// @param maxlength Longest code allowed, at most MAXCODELEN
+void LimitCodeLengths(HuffmanNode *leaves, int n, unsigned char maxlength)
+{
+    uint64_t weight[2][2 * BYTEMAX]; // item weights of the level below and the current level
+    short kind[MAXCODELEN][2 * BYTEMAX]; // per level and item: index of the symbol, or -1 for a package
+    int size[MAXCODELEN];
+    int below = 0, current = 1;
+
+    // deepest level holds just the symbols
+    for (int i = 0; i < n; i++)
+    {
+        weight[below][i] = leaves[i].frequency;
+        kind[maxlength - 1][i] = (short)i;
+    }
+    size[maxlength - 1] = n;
+
+    for (int level = maxlength - 2; level >= 0; level--)
+    {
+        int packages = size[level + 1] / 2, leaf = 0, package = 0, count = 0;
+        // merge the symbols with the packages of the level below, symbols first on ties
+        while (leaf < n || package < packages)
+        {
+            uint64_t pweight = 0;
+            if (package < packages)
+                pweight = weight[below][2 * package] + weight[below][2 * package + 1];
+            if (package == packages || (leaf < n && leaves[leaf].frequency <= pweight))
+            {
+                weight[current][count] = leaves[leaf].frequency;
+                kind[level][count++] = (short)leaf++;
+            }
+            else
+            {
+                weight[current][count] = pweight;
+                kind[level][count++] = -1;
+                package++;
+            }
+        }
+        size[level] = count;
+        below = current;
+        current = 1 - current;
+    }
+
+    for (int i = 0; i < n; i++)
+        leaves[i].codelength = 0;
+
+    // walk down from the top, each chosen package choosing two items of the level below it
+    int chosen = 2 * n - 2;
+    for (int level = 0; level < maxlength && chosen > 0; level++)
+    {
+        int packages = 0;
+        for (int i = 0; i < chosen; i++)
+        {
+            if (kind[level][i] < 0)
+                packages++;
+            else
+                leaves[kind[level][i]].codelength++;
+        }
+        chosen = 2 * packages;
+    }
+}
+
+/// @brief Given tree with initialized symbols, builds tree and sets root node. Codes longer than
+/// maxlength are replaced by the optimal code lengths within the limit before the canonical codes are set
+/// @param ht The huffman tree object to build the tree within
+/// @param maxlength Longest code allowed, from 1 to 32 (HT_MAXCODELEN is a good default)
+/// @return 0 if successful, -1 if determined root frequency does not match size of file or maxlength
+/// is too short to give every symbol a code
+int BuildHTFromFrequencies(HuffmanTree *ht, unsigned char maxlength)
+{
+    unsigned int numInternalNodes = 0, numLeafNodes = ht->count, numNodesProcessed = 0;
+
+    if (maxlength == 0 || maxlength > MAXCODELEN || (numLeafNodes > 1 && ((uint64_t)1 << maxlength) < numLeafNodes))
+    {
+        return -1;
+    }
+
+    if (numLeafNodes == 0)
+    { // empty input, nothing to code
+        ht->root = HT_NONE;
+        return ht->bytecount == 0 ? 0 : -1;
+    }
+
+    // sort the leaves once; the parents are then created in order of increasing frequency, so the
+    // two lowest nodes are always at the front of either the leaf queue or the parent queue
+    qsort(ht->tree, numLeafNodes, sizeof(HuffmanNode), CompareNodes);
+
+    unsigned int nextParent = numLeafNodes;
+    while (numInternalNodes < (numLeafNodes - 1))
+    {
+        unsigned short children[2];
+        // grab the two lowest freq nodes, leaves first on ties
+        for (int c = 0; c < 2; c++)
+        {
+            if (numNodesProcessed < numLeafNodes &&
+                (nextParent == numLeafNodes + numInternalNodes || ht->tree[numNodesProcessed].frequency <= ht->tree[nextParent].frequency))
+                children[c] = (unsigned short)numNodesProcessed++;
+            else
+                children[c] = (unsigned short)nextParent++;
+        }
+
+        // Insert a node at the end of the tree with frequency as the sum of the two children
+        HuffmanNode *parentNode = &ht->tree[numLeafNodes + numInternalNodes];
+        parentNode->value = 0;
+        parentNode->hcode = 0;
+        parentNode->left = children[0];
+        parentNode->right = children[1];
+        parentNode->frequency = ht->tree[children[0]].frequency + ht->tree[children[1]].frequency;
+        numInternalNodes++;
+    }
+
+    ht->count += numInternalNodes;
+    ht->root = (unsigned short)(ht->count - 1);
+
+    // one pass from the root down sets every depth, as parents always sit after their children
+    unsigned char longest = 0;
+    ht->tree[ht->root].codelength = 0;
+    for (int i = ht->count - 1; i >= (int)numLeafNodes; i--)
+    {
+        HuffmanNode *parentNode = &ht->tree[i];
+        ht->tree[parentNode->left].codelength = ht->tree[parentNode->right].codelength = parentNode->codelength + 1;
+        if (parentNode->codelength + 1 > longest)
+            longest = parentNode->codelength + 1;
+    }
+
+    // a lone symbol is its own root, give it a 1 bit code so every occurrence still writes a bit
+    if (numLeafNodes == 1)
+    {
+        ht->tree[ht->root].codelength = 1;
+    }
+
+    // skewed inputs can make the tree deeper than the limit (or than hcode can hold)
+    if (longest > maxlength)
+    {
+        LimitCodeLengths(ht->tree, numLeafNodes, maxlength);
+    }
+
+    // the tree only fixes the code lengths, hand out canonical codes so a header of lengths suffices
+    if (AssignCanonicalCodes(ht) != 0)
+    {
+        return -1;
+    }
+    if (ht->decoder != NULL)
+    { // tables of the previous codes
+        ht->decoder->ready = false;
+    }
+
+    if (ht->tree[ht->root].frequency == ht->bytecount)
+    {
+        return 0;
+    }
+    else
+    {
+        return -1;
+    }
+}
+
+/// @brief Writes the canonical code lengths of the tree as the file header. Tens of bytes for most inputs
+/// @param ht The huffman tree, built by BuildHTFromFrequencies
+/// @param output The stream to write the header to
+/// @return 0 if successful, -1 on a null tree or file
+int WriteCompressedTreeToFile(HuffmanTree *ht, FILE *output)
+{
+    unsigned char lengths[BYTEMAX] = {0};
+    unsigned char header[LENGTHS_MAXSIZE];
+
+    if (ht == NULL || output == NULL)
+        return -1;
+
+    for (int i = 0; i < ht->count; i++)
+    {
+        if (ht->tree[i].left == HT_NONE)
+            lengths[ht->tree[i].value] = ht->tree[i].codelength;
+    }
+    fwrite(header, sizeof(unsigned char), PackCodeLengths(lengths, header), output);
+
+    return 0;
+}
+
+int WriteTreeToFile(HuffmanTree *ht, FILE *output)
+{
+    // Write the huffman tree to the file so that it can be used on decode
+    fwrite(&ht->bytecount, sizeof(uint64_t), 1, output);
+    fwrite(&ht->count, sizeof(unsigned int), 1, output);
+    fwrite(&ht->maxfreq, sizeof(uint64_t), 1, output);
+    fwrite(&ht->root, sizeof(unsigned short), 1, output);
+
+    // the nodes link by index, so the used part of the arena can be written as is
+    fwrite(ht->tree, sizeof(HuffmanNode), ht->count, output);
+
+    return 0;
+}
+
+/// @brief Builds the symbol to code table from the symbol nodes of a tree
+/// @param ht The huffman tree holding the codes
+/// @param table Table of BYTEMAX entries to fill
+void BuildEncodeTable(HuffmanTree *ht, EncodeEntry *table)
+{
+    for (int i = 0; i < BYTEMAX; i++)
+    {
+        table[i].hcode = 0;
+        table[i].codelength = 0;
+        table[i].present = false;
+    }
+    for (int i = 0; i < ht->count; i++)
+    {
+        HuffmanNode *node = &ht->tree[i];
+        if (node->left == HT_NONE)
+        {
+            table[node->value].hcode = node->hcode;
+            table[node->value].codelength = node->codelength;
+            table[node->value].present = true;
+        }
+    }
+}
+
+/// @brief Empties the full buffer of a bit writer into its stream or pipeline
+/// @param bw The bit writer
+void DrainBits(BitWriter *bw)
+{
+    if (bw->output != NULL)
+        fwrite(bw->buffer, sizeof(unsigned char), bw->len, bw->output);
+    else if (bw->pipe != NULL)
+    {
+        PushPipeSlot(&bw->pipe->out, bw->len);
+        bw->buffer = GetPipeSlot(&bw->pipe->out);
+    }
+    else
+        bw->overflow = true;
+    bw->len = 0;
+}
+
+/// @brief Appends a code to the bit writer, moving a full 32 bit word to the buffer once available
+/// @param bw The bit writer
+/// @param hcode The code, first bit in the LSB
+/// @param len Length of the code, at most 32
+void PutBits(BitWriter *bw, unsigned int hcode, unsigned char len)
+{
+    bw->bits |= (uint64_t)hcode << bw->count;
+    bw->count += len;
+    if (bw->count >= 32)
+    {
+        if (bw->len + 4 > bw->cap)
+            DrainBits(bw);
+        bw->buffer[bw->len++] = (unsigned char)bw->bits;
+        bw->buffer[bw->len++] = (unsigned char)(bw->bits >> 8);
+        bw->buffer[bw->len++] = (unsigned char)(bw->bits >> 16);
+        bw->buffer[bw->len++] = (unsigned char)(bw->bits >> 24);
+        bw->bits >>= 32;
+        bw->count -= 32;
+    }
+}
+
+/// @brief Writes out all pending bits. A partial final byte holds its bits in the top, followed
+/// by a byte giving the number of valid bits in it (0 if the final byte is full)
+/// @param bw The bit writer
+void FlushBits(BitWriter *bw)
+{
+    unsigned char bitsinbyte = bw->count & 7;
+
+    if (bw->len + 6 > bw->cap)
+        DrainBits(bw);
+    while (bw->count >= 8)
+    {
+        bw->buffer[bw->len++] = (unsigned char)bw->bits;
+        bw->bits >>= 8;
+        bw->count -= 8;
+    }
+    if (bitsinbyte != 0)
+        bw->buffer[bw->len++] = (unsigned char)(bw->bits << (8 - bitsinbyte));
+    bw->buffer[bw->len++] = bitsinbyte;
+
+    DrainBits(bw);
+    bw->bits = 0;
+    bw->count = 0;
+}
+
+/// @brief Writes out all pending bits into the buffer, zero padding the top of the final byte.
+/// Used for memory only writers, whose readers know how many symbols to decode
+/// @param bw The bit writer
+void FinishBits(BitWriter *bw)
+{
+    while (bw->count > 0)
+    {
+        if (bw->len == bw->cap)
+        {
+            bw->overflow = true;
+            return;
+        }
+        bw->buffer[bw->len++] = (unsigned char)bw->bits;
+        bw->bits >>= 8;
+        bw->count = bw->count > 8 ? bw->count - 8 : 0;
+    }
+}
+
+/// @brief Encodes every byte of the input with the tree's codes (second pass of compression). Unless the
+/// input is a file of less than PIPE_MINSIZE bytes, a reader thread reads it ahead and a writer thread
+/// writes the codes behind, so the coding overlaps both
+/// @param ht The huffman tree built from the input
+/// @param input The stream to compress
+/// @param output The stream to write the encoded data to
+/// @return 0 if successful, -1 if the input holds a byte the tree has no code for or the input or output fails
+int WriteDataToFile(HuffmanTree *ht, FILE *input, FILE *output)
+{
+    EncodeEntry table[BYTEMAX];
+    unsigned char direct[IOBUFSIZE];
+    Pipeline pipe;
+    const unsigned char *inbuf = direct;
+    size_t inlen;
+    BitWriter writer = {0};
+    bool piped;
+    int status = 0;
+
+    if (ht == NULL || input == NULL || output == NULL)
+        return -1;
+
+    BuildEncodeTable(ht, table);
+
+    // a stream of unknown size may be long, so only a small file is coded without the pipeline
+    piped = GetBytesLeft(input) >= PIPE_MINSIZE;
+    if (piped)
+    {
+        if (StartPipeline(&pipe, input, output, UINT64_MAX) != 0)
+            return -1;
+        writer.buffer = GetPipeSlot(&pipe.out);
+        writer.cap = PIPE_BUFSIZE;
+        writer.pipe = &pipe;
+    }
+    else
+    {
+        writer.buffer = (unsigned char *)malloc(IOBUFSIZE);
+        if (writer.buffer == NULL)
+            return -1;
+        writer.cap = IOBUFSIZE;
+        writer.output = output;
+    }
+
+    while (status == 0)
+    {
+        if (piped)
+            inbuf = PeekPipeSlot(&pipe.in, &inlen);
+        else
+            inlen = fread(direct, sizeof(unsigned char), IOBUFSIZE, input);
+        if (inlen == 0)
+            break;
+        for (size_t i = 0; i < inlen; i++)
+        {
+            EncodeEntry code = table[inbuf[i]];
+            if (!code.present)
+            {
+                status = -1;
+                break;
+            }
+            PutBits(&writer, code.hcode, code.codelength);
+        }
+        if (piped)
+        {
+            PopPipeSlot(&pipe.in);
+            if (atomic_load_explicit(&pipe.out.closed, memory_order_relaxed))
+                status = -1; // the writer stage failed, stop coding for it
+        }
+        else if (ferror(output))
+            status = -1;
+    }
+    FlushBits(&writer);
+
+    if (piped)
+        return StopPipeline(&pipe, status);
+    free(writer.buffer);
+    return ferror(input) || ferror(output) ? -1 : status;
+}
+
+#pragma endregion Compression
+
+#pragma region Decompression
+
+/// @brief Builds the decode lookup tables from a list of codes
+/// @param dt The table to fill. Its sub tables are reused if large enough, else (re)allocated
+/// @param symbols The symbols that have a code
+/// @param n Number of symbols
+/// @param codes Codes indexed by symbol value
+/// @return 0 if successful, -1 on allocation failure
+int FillDecodeTable(DecodeTable *dt, const uint16_t *symbols, unsigned int n, const EncodeEntry *codes)
+{
+    const unsigned int rootsize = 1U << DECODE_ROOTBITS;
+    unsigned int subsize = 0;
+
+    for (unsigned int i = 0; i < rootsize; i++)
+    {
+        dt->primary[i].value = 0;
+        dt->primary[i].length = 0;
+        dt->primary[i].subbits = 0;
+    }
+    dt->maxlength = 0;
+
+    // First pass: size a sub table for every root prefix shared by codes longer than the root
+    for (unsigned int i = 0; i < n; i++)
+    {
+        const EncodeEntry *code = &codes[symbols[i]];
+        if (code->codelength > dt->maxlength)
+            dt->maxlength = code->codelength;
+        if (code->codelength > DECODE_ROOTBITS)
+        {
+            DecodeEntry *entry = &dt->primary[code->hcode & (rootsize - 1)];
+            if (code->codelength - DECODE_ROOTBITS > entry->subbits)
+                entry->subbits = code->codelength - DECODE_ROOTBITS;
+        }
+    }
+    for (unsigned int i = 0; i < rootsize; i++)
+    {
+        if (dt->primary[i].subbits != 0)
+        {
+            dt->primary[i].value = subsize;
+            subsize += 1U << dt->primary[i].subbits;
+        }
+    }
+    if (subsize > dt->subcapacity)
+    { // grow the sub tables, a reused table keeps the larger allocation
+        if (dt->fixed)
+            return -1;
+        DecodeEntry *sub = (DecodeEntry *)realloc(dt->sub, subsize * sizeof(DecodeEntry));
+        if (sub == NULL)
+            return -1;
+        dt->sub = sub;
+        dt->subcapacity = subsize;
+    }
+    for (unsigned int i = 0; i < subsize; i++)
+    {
+        dt->sub[i].length = 0;
+        dt->sub[i].subbits = 0;
+    }
+
+    // Second pass: every slot whose bottom bits match a code decodes to that code's symbol
+    for (unsigned int i = 0; i < n; i++)
+    {
+        const EncodeEntry *code = &codes[symbols[i]];
+        unsigned int len = code->codelength;
+        if (len == 0)
+            continue;
+        if (len <= DECODE_ROOTBITS)
+        {
+            for (unsigned int slot = code->hcode & ((1U << len) - 1); slot < rootsize; slot += 1U << len)
+            {
+                dt->primary[slot].value = symbols[i];
+                dt->primary[slot].length = len;
+            }
+        }
+        else
+        {
+            DecodeEntry *link = &dt->primary[code->hcode & (rootsize - 1)];
+            DecodeEntry *subtable = &dt->sub[link->value];
+            unsigned int bits = (unsigned int)((uint64_t)code->hcode >> DECODE_ROOTBITS);
+            for (unsigned int slot = bits & ((1U << (len - DECODE_ROOTBITS)) - 1); slot < (1U << link->subbits); slot += 1U << (len - DECODE_ROOTBITS))
+            {
+                subtable[slot].value = symbols[i];
+                subtable[slot].length = len;
+            }
+        }
+    }
+    return 0;
+}
+
+/// @brief Builds the decode lookup tables from the symbol nodes of a tree
+/// @param ht The huffman tree holding the codes
+/// @param dt The table to fill. Its sub tables are reused if large enough, else (re)allocated
+/// @return 0 if successful, -1 on allocation failure
+int BuildDecodeTable(HuffmanTree *ht, DecodeTable *dt)
+{
+    EncodeEntry codes[BYTEMAX];
+    uint16_t symbols[BYTEMAX];
+    unsigned int n = 0;
+
+    for (int i = 0; i < ht->count; i++)
+    {
+        HuffmanNode *node = &ht->tree[i];
+        if (node->left != HT_NONE)
+            continue;
+        symbols[n++] = node->value;
+        codes[node->value].hcode = node->hcode;
+        codes[node->value].codelength = node->codelength;
+        codes[node->value].present = true;
+    }
+    return FillDecodeTable(dt, symbols, n, codes);
+}
+
+/// @brief Gets the decode tables of a tree, building them if the tree's codes changed since the last build
+/// @param ht The huffman tree
+/// @return the tables, kept in ht->decoder, or NULL on allocation failure
+DecodeTable *GetDecodeTable(HuffmanTree *ht)
+{
+    if (ht->decoder == NULL)
+    {
+        ht->decoder = (DecodeTable *)calloc(1, sizeof(DecodeTable));
+        if (ht->decoder == NULL)
+            return NULL;
+    }
+    if (!ht->decoder->ready)
+    {
+        if (BuildDecodeTable(ht, ht->decoder) != 0)
+            return NULL;
+        ht->decoder->ready = true;
+    }
+    return ht->decoder;
+}
+
+/// @brief Tops the bit buffer up to at least 56 bits, or until the data runs out
+/// @param br The bit reader to refill
+void RefillBits(BitReader *br)
+{
+    if (br->input == NULL && (br->pipe == NULL || br->remaining != 0) && br->pos + 8 <= br->len)
+    { // whole word load; bytes past the counted ones are loaded again by the next refill. The final
+      // slot of a pipeline ends in a partial byte, so it is read a byte at a time
+        uint64_t word;
+        memcpy(&word, br->buffer + br->pos, sizeof(word));
+        br->bits |= word << br->count;
+        br->pos += (63 - br->count) >> 3;
+        br->count |= 56;
+        return;
+    }
+    while (br->count <= 56)
+    {
+        if (br->pos == br->len && br->pipe != NULL)
+        { // hand the used slot back to the reader stage and wait for the next
+            if (br->buffer != NULL)
+                PopPipeSlot(&br->pipe->in);
+            br->buffer = NULL;
+            br->pos = br->len = 0;
+            if (br->remaining == 0)
+                return;
+            br->buffer = PeekPipeSlot(&br->pipe->in, &br->len);
+            if (br->len == 0)
+            { // truncated input, treat as the end of the data
+                br->remaining = 0;
+                return;
+            }
+            br->remaining -= br->len;
+        }
+        else if (br->pos == br->len)
+        {
+            if (br->input == NULL || br->remaining == 0)
+                return;
+            size_t want = br->remaining < IOBUFSIZE ? br->remaining : IOBUFSIZE;
+            br->len = fread(br->storage, sizeof(unsigned char), want, br->input);
+            br->pos = 0;
+            if (br->len == 0)
+            { // truncated input, treat as the end of the data
+                br->remaining = 0;
+                return;
+            }
+            br->remaining -= br->len;
+        }
+        uint64_t byte = br->buffer[br->pos++];
+        if (br->pos == br->len && br->remaining == 0 && br->lastbits != 0)
+        { // the valid bits of the final byte were written into its top
+            br->bits |= (byte >> (8 - br->lastbits)) << br->count;
+            br->count += br->lastbits;
+        }
+        else
+        {
+            br->bits |= byte << br->count;
+            br->count += 8;
+        }
+    }
+}
+
+/// @brief Fills an empty tree with symbol nodes carrying the canonical codes for the given lengths
+/// @param ht The empty huffman tree
+/// @param lengths Code length of each of the BYTEMAX symbols, 0 if absent
+/// @return 0 if successful, -1 if the lengths cannot come from a huffman tree
+int LoadCodeLengths(HuffmanTree *ht, const unsigned char *lengths)
+{
+    uint64_t kraft = 0;
+
+    for (int value = 0; value < BYTEMAX; value++)
+    {
+        if (lengths[value] == 0)
+            continue;
+        HuffmanNode *hnode = &ht->tree[ht->count++];
+        hnode->value = (unsigned char)value;
+        hnode->frequency = 0;
+        hnode->codelength = lengths[value];
+        hnode->left = HT_NONE;
+        hnode->right = HT_NONE;
+        kraft += (uint64_t)1 << (MAXCODELEN - lengths[value]);
+    }
+    // lengths that oversubscribe the code space cannot come from a huffman tree
+    if (kraft > ((uint64_t)1 << MAXCODELEN) || AssignCanonicalCodes(ht) != 0)
+        return -1;
+    return 0;
+}
+
+/// @brief Reads a header written by WriteCompressedTreeToFile, rebuilds the canonical codes from the
+/// lengths and builds the decode tables. The tree only holds symbol nodes
+/// @param input The compressed stream, positioned at the header
+/// @return the tree, or NULL if the header is malformed
+HuffmanTree *ReadCompressedTreeFromFile(FILE *input)
+{
+    unsigned char header[LENGTHS_MAXSIZE];
+    unsigned char lengths[BYTEMAX];
+    size_t size = 1;
+
+    if (input == NULL || fread(header, sizeof(unsigned char), 1, input) != 1)
+        return NULL;
+
+    // read just the header, the data follows straight after it
+    if (header[0] == LENGTHS_PACKED)
+    {
+        int present = 0;
+        size += fread(&header[1], sizeof(unsigned char), BYTEMAX / 8, input);
+        for (int i = 0; i < BYTEMAX / 8 && i + 1 < size; i++)
+        {
+            for (unsigned char bits = header[1 + i]; bits != 0; bits &= bits - 1)
+                present++;
+        }
+        size += fread(&header[size], sizeof(unsigned char), (present + 1) / 2, input);
+    }
+    else
+    {
+        int filled = 0, op;
+        while (filled < BYTEMAX && size < LENGTHS_MAXSIZE && (op = fgetc(input)) != EOF)
+        {
+            header[size++] = (unsigned char)op;
+            if (op & 0x80)
+                filled += (op & 0x7F) + 1;
+            else if (op & 0x40)
+                filled += (op & 0x3F) + 1;
+            else
+                filled++;
+        }
+    }
+    if (UnpackCodeLengths(header, size, lengths) < 0)
+        return NULL;
+
+    HuffmanTree *ht = InitHT();
+    if (ht == NULL)
+        return NULL;
+
+    if (LoadCodeLengths(ht, lengths) != 0 || GetDecodeTable(ht) == NULL)
+    {
+        FreeHT(ht);
+        return NULL;
+    }
+    return ht;
+}
+
+/// @brief Reads a Huffman tree written by WriteTreeToFile, including the links between the nodes
+/// @param input The stream, positioned at the tree
+/// @return the tree, or NULL if it is truncated or malformed
+HuffmanTree *ReadTreeFromFile(FILE *input)
+{
+    HuffmanTree *ht = InitHT();
+    if (ht == NULL)
+    {
+        return NULL;
+    }
+
+    if (fread(&ht->bytecount, sizeof(uint64_t), 1, input) != 1 ||
+        fread(&ht->count, sizeof(unsigned int), 1, input) != 1 ||
+        fread(&ht->maxfreq, sizeof(uint64_t), 1, input) != 1 ||
+        fread(&ht->root, sizeof(unsigned short), 1, input) != 1 ||
+        ht->count > HTSIZE || fread(ht->tree, sizeof(HuffmanNode), ht->count, input) != ht->count)
+    {
+        FreeHT(ht);
+        return NULL;
+    }
+
+    return ht;
+}
+
+/// @brief Decodes the data section of a compressed file with the tree's codes. Unless the data is less
+/// than PIPE_MINSIZE bytes, a reader thread reads it ahead and a writer thread writes the decoded bytes
+/// behind, so the decoding overlaps both
+/// @param ht The huffman tree the data was encoded with
+/// @param input The compressed stream, positioned at the start of the data
+/// @param output The stream to write the decoded bytes to
+/// @return 0 if successful, -1 on a malformed stream, allocation failure, failed read or failed write
+int ReadDataFromFile(HuffmanTree *ht, FILE *input, FILE *output)
+{
+    DecodeTable *table;
+    unsigned char direct[IOBUFSIZE];
+    Pipeline pipe;
+    BitReader br = {0}, *reader = &br;
+    unsigned char *outbuf = direct;
+    size_t outlen = 0, outcap = IOBUFSIZE;
+    off_t start, end;
+    bool piped;
+    int status = 0;
+
+    if (ht == NULL || input == NULL || output == NULL)
+        return -1;
+
+    // data runs up to the final byte, which holds the number of valid bits in the last data byte
+    start = ftello(input);
+    fseeko(input, 0, SEEK_END);
+    end = ftello(input);
+    if (start < 0 || end - start < 1)
+        return -1;
+
+    reader->remaining = (uint64_t)(end - start - 1);
+    fseeko(input, -1, SEEK_END);
+    if (fread(&reader->lastbits, sizeof(unsigned char), 1, input) != 1)
+        reader->lastbits = 0;
+    fseeko(input, start, SEEK_SET);
+
+    table = GetDecodeTable(ht);
+    if (table == NULL)
+        return -1;
+    piped = reader->remaining >= PIPE_MINSIZE;
+    if (piped)
+    {
+        if (StartPipeline(&pipe, input, output, reader->remaining) != 0)
+            return -1;
+        reader->pipe = &pipe;
+        outbuf = GetPipeSlot(&pipe.out);
+        outcap = PIPE_BUFSIZE;
+    }
+    else
+    {
+        reader->storage = (unsigned char *)malloc(IOBUFSIZE);
+        if (reader->storage == NULL)
+            return -1;
+        reader->buffer = reader->storage;
+        reader->input = input;
+    }
+
+    const uint64_t rootmask = (1U << DECODE_ROOTBITS) - 1;
+    while (status == 0)
+    {
+        RefillBits(reader);
+        if (reader->count == 0)
+            break;
+
+        // decode until the buffer can no longer be trusted to hold a whole code
+        do
+        {
+            DecodeEntry entry = table->primary[reader->bits & rootmask];
+            if (entry.subbits != 0)
+                entry = table->sub[entry.value + ((reader->bits >> DECODE_ROOTBITS) & ((1U << entry.subbits) - 1))];
+            if (entry.length == 0)
+            {
+                status = -1; // no code matches these bits
+                break;
+            }
+            if (entry.length > reader->count)
+            {
+                status = 1; // the trailing bits do not form a whole code
+                break;
+            }
+
+            reader->bits >>= entry.length;
+            reader->count -= entry.length;
+            outbuf[outlen++] = (unsigned char)entry.value;
+            if (outlen == outcap && piped)
+            {
+                PushPipeSlot(&pipe.out, outlen);
+                outbuf = GetPipeSlot(&pipe.out);
+                outlen = 0;
+                if (atomic_load_explicit(&pipe.out.closed, memory_order_relaxed))
+                    status = -1; // the writer stage failed, stop decoding for it
+            }
+            else if (outlen == outcap)
+            {
+                if (fwrite(outbuf, sizeof(unsigned char), outlen, output) != outlen)
+                    status = -1;
+                outlen = 0;
+            }
+        } while (reader->count >= table->maxlength && reader->count != 0);
+    }
+
+    if (piped)
+    {
+        if (outlen != 0)
+            PushPipeSlot(&pipe.out, outlen);
+        return StopPipeline(&pipe, status < 0 ? -1 : 0);
+    }
+    if (outlen != 0 && fwrite(outbuf, sizeof(unsigned char), outlen, output) != outlen)
+        status = -1;
+    free(reader->storage);
+    return status < 0 || ferror(input) ? -1 : 0;
+}
+
+#pragma endregion Decompression
+
+#pragma region Blocks
+
+/// @brief Number of the block's bytes coded in each stream of a BLOCK_HUFFMAN4 block. Every stream but
+/// the last holds this many, the last holds what is left
+/// @param rawsize Size of the block
+/// @return bytes per stream
+size_t StreamLength(size_t rawsize)
+{
+    return (rawsize + BLOCK_STREAMS - 1) / BLOCK_STREAMS;
+}
+
+/// @brief Writes the header of a block container
+/// @param out Buffer of FORMAT_HEADERSIZE bytes
+/// @param blocksize Bytes per block
+/// @param rawsize Size of the data before compression, HT_UNKNOWNSIZE if it is not known
+void PutFormatHeader(unsigned char *out, size_t blocksize, uint64_t rawsize)
+{
+    memcpy(out, FORMAT_MAGIC, 3);
+    out[3] = FORMAT_VERSION;
+    PutU32(out + 4, (uint32_t)blocksize);
+    PutU64(out + 8, rawsize);
+}
+
+/// @brief Checks the header of a block container
+/// @param header The FORMAT_HEADERSIZE bytes of the header
+/// @param blocksize Set to the block size
+/// @param rawsize Set to the size of the data before compression, HT_UNKNOWNSIZE if the writer did not know it
+/// @return 0 if successful, -1 if the header is not one of this version
+int ParseFormatHeader(const unsigned char *header, size_t *blocksize, uint64_t *rawsize)
+{
+    if (memcmp(header, FORMAT_MAGIC, 3) != 0 || header[3] != FORMAT_VERSION)
+        return -1;
+    *blocksize = GetU32(header + 4);
+    *rawsize = GetU64(header + 8);
+    if (*blocksize < HT_MINBLOCKSIZE || *blocksize > HT_MAXBLOCKSIZE)
+        return -1;
+    return 0;
+}
+
+/// @brief Codes bytes into a memory bit stream
+/// @param table Codes by byte value
+/// @param in The bytes to code
+/// @param len Number of bytes
+/// @param out Buffer for the stream
+/// @param cap Size of out
+/// @return size of the stream in bytes, or -1 if it does not fit
+long EncodeStream(const EncodeEntry *table, const unsigned char *in, size_t len, unsigned char *out, size_t cap)
+{
+    BitWriter writer = {0};
+
+    writer.buffer = out;
+    writer.cap = cap;
+    for (size_t i = 0; i < len; i++)
+        PutBits(&writer, table[in[i]].hcode, table[in[i]].codelength);
+    FinishBits(&writer);
+    return writer.overflow ? -1 : (long)writer.len;
+}
+
+/// @brief Compresses one block into a self contained block: header, code lengths, then the codes. The
+/// cost of the codes is worked out from the histogram first, and a block of one repeated byte is stored
+/// as that byte, and a block the codes would not shrink is stored as it is
+/// @param ht The tree to build the block's code in, reset first
+/// @param in The bytes of the block
+/// @param len Number of bytes, at most HT_MAXBLOCKSIZE
+/// @param out Buffer for the block
+/// @param cap Size of out. BLOCK_BOUND(len) always fits the block
+/// @param flags HT_INTERLEAVE to code the block as BLOCK_STREAMS streams, HT_CHECKSUM to store the
+/// CRC-32C of its bytes
+/// @param stats Where the block's stats are added, NULL to gather none
+/// @return size of the block in bytes, or -1 on failure or if the block does not fit
+long EncodeBlock(HuffmanTree *ht, const unsigned char *in, size_t len, unsigned char *out, size_t cap, unsigned int flags,
+                 BlockStats *stats)
+{
+    EncodeEntry table[BYTEMAX];
+    unsigned char lengths[BYTEMAX] = {0};
+    size_t start = (flags & HT_CHECKSUM) ? BLOCK_HEADERSIZE + BLOCK_CHECKSIZE : BLOCK_HEADERSIZE, pos = start;
+    unsigned char type = (flags & HT_INTERLEAVE) ? BLOCK_HUFFMAN4 : BLOCK_HUFFMAN;
+    uint64_t codebits = 0;
+    BlockStats local = {0};
+    uint64_t mark = stats != NULL ? GetTimeNs() : 0;
+
+    if (cap < BLOCK_BOUND(0))
+        return -1; // the streams check their own room
+
+    if (flags & HT_CHECKSUM)
+    {
+        PutU32(out + BLOCK_HEADERSIZE, GetChecksum(in, len));
+        local.checksumns = Lap(stats, &mark);
+    }
+
+    ResetHT(ht);
+    if (InitializeLeafNodesFromMemory(in, len, ht, 1) != 0)
+        return -1;
+    local.histogramns = Lap(stats, &mark);
+
+    if (ht->count == 1)
+    { // one distinct byte needs no code at all
+        type = BLOCK_RLE;
+        out[pos++] = ht->tree[0].value;
+    }
+    else
+    {
+        if (BuildHTFromFrequencies(ht, HT_MAXCODELEN) != 0)
+            return -1;
+        for (int i = 0; i < ht->count; i++)
+        {
+            if (ht->tree[i].left != HT_NONE)
+                continue;
+            lengths[ht->tree[i].value] = ht->tree[i].codelength;
+            codebits += (uint64_t)ht->tree[i].frequency * ht->tree[i].codelength;
+        }
+        local.buildns = Lap(stats, &mark);
+        pos += PackCodeLengths(lengths, out + pos);
+        local.headerns = Lap(stats, &mark);
+
+        // the lengths, the jump table and the padding of every stream have to be paid for too
+        size_t streams = type == BLOCK_HUFFMAN4 ? BLOCK_STREAMS : 1;
+        size_t coded = pos - start + (streams > 1 ? BLOCK_JUMPSIZE : 0) + streams + codebits / 8;
+        if (coded >= len)
+        {
+            type = BLOCK_RAW;
+            pos = start;
+            codebits = 8 * (uint64_t)len;
+            if (cap - pos < len)
+                return -1;
+            if (len != 0)
+                memcpy(out + pos, in, len);
+            pos += len;
+        }
+    }
+
+    if (type == BLOCK_HUFFMAN || type == BLOCK_HUFFMAN4)
+        BuildEncodeTable(ht, table);
+    if (type == BLOCK_HUFFMAN4)
+    { // the streams go back to back after a jump table of the sizes of all but the last
+        size_t jump = pos, stream = StreamLength(len);
+        pos += BLOCK_JUMPSIZE;
+        for (int i = 0; i < BLOCK_STREAMS; i++)
+        {
+            size_t first = i * stream < len ? i * stream : len;
+            size_t count = len - first < stream ? len - first : stream;
+            long size = EncodeStream(table, in + first, count, out + pos, cap - pos);
+            if (size < 0)
+                return -1;
+            if (i < BLOCK_STREAMS - 1)
+                PutU32(out + jump + 4 * i, (uint32_t)size);
+            pos += size;
+        }
+    }
+    else if (type == BLOCK_HUFFMAN)
+    {
+        long size = EncodeStream(table, in, len, out + pos, cap - pos);
+        if (size < 0)
+            return -1;
+        pos += size;
+    }
+
+    out[0] = (flags & HT_CHECKSUM) ? type | BLOCK_CHECKED : type;
+    PutU32(out + 1, (uint32_t)len);
+    PutU32(out + 5, (uint32_t)(pos - BLOCK_HEADERSIZE));
+
+    if (stats != NULL)
+    {
+        local.codens = Lap(stats, &mark);
+        local.blocks = 1;
+        local.symbols = len;
+        local.coded = pos;
+        local.codebits = codebits;
+        local.entropybits = EntropyBits(ht);
+        if (type == BLOCK_HUFFMAN || type == BLOCK_HUFFMAN4)
+            AddTableStats(&local, lengths);
+        MergeStats(stats, &local);
+    }
+    return (long)pos;
+}
+
+/// @brief Looks up the code at the bottom of a bit buffer
+/// @param table The decode tables
+/// @param bits The bit buffer
+/// @return the entry of the code, with length 0 if no code matches
+DecodeEntry LookupCode(const DecodeTable *table, uint64_t bits)
+{
+    DecodeEntry entry = table->primary[bits & ((1U << DECODE_ROOTBITS) - 1)];
+    if (entry.subbits != 0)
+        entry = table->sub[entry.value + ((bits >> DECODE_ROOTBITS) & ((1U << entry.subbits) - 1))];
+    return entry;
+}
+
+/// @brief Decodes a number of symbols from a memory bit reader
+/// @param table The decode tables
+/// @param reader The reader, positioned at the first code
+/// @param out Buffer for the decoded bytes
+/// @param count Number of symbols to decode
+/// @return 0 if successful, -1 on an invalid code or if the stream runs out
+int DecodeSymbols(const DecodeTable *table, BitReader *reader, unsigned char *out, size_t count)
+{
+    size_t produced = 0;
+
+    while (produced < count)
+    {
+        RefillBits(reader);
+        if (reader->count == 0)
+            return -1; // ran out of bits
+
+        // decode until the buffer can no longer be trusted to hold a whole code
+        do
+        {
+            DecodeEntry entry = LookupCode(table, reader->bits);
+            if (entry.length == 0 || entry.length > reader->count)
+                return -1;
+            reader->bits >>= entry.length;
+            reader->count -= entry.length;
+            out[produced++] = (unsigned char)entry.value;
+        } while (produced < count && reader->count >= table->maxlength);
+    }
+    return 0;
+}
+
+/// @brief Decodes the streams of a BLOCK_HUFFMAN4 block. While every stream has symbols left they are
+/// decoded in step, one symbol from each per round, so the lookups of the 4 streams overlap
+/// @param table The decode tables
+/// @param streams Readers over the streams, positioned at their first codes
+/// @param out Buffer for the decoded block
+/// @param rawsize Size of the block
+/// @return 0 if successful, -1 if a stream is malformed
+int DecodeInterleaved(const DecodeTable *table, BitReader *streams, unsigned char *out, size_t rawsize)
+{
+    size_t stream = StreamLength(rawsize), done = 0, counts[BLOCK_STREAMS];
+    unsigned int perrefill = 56 / table->maxlength; // symbols a refilled reader is sure to hold
+    unsigned char invalid = 0;
+    BitReader s0 = streams[0], s1 = streams[1], s2 = streams[2], s3 = streams[3];
+    unsigned char *o0 = out, *o1 = out + stream, *o2 = out + 2 * stream, *o3 = out + 3 * stream;
+
+    for (int i = 0; i < BLOCK_STREAMS; i++)
+        counts[i] = i * stream >= rawsize ? 0 : (rawsize - i * stream < stream ? rawsize - i * stream : stream);
+
+    // the last stream is the shortest, so every stream has a symbol left while it does
+    while (counts[BLOCK_STREAMS - 1] - done >= perrefill)
+    {
+        RefillBits(&s0);
+        RefillBits(&s1);
+        RefillBits(&s2);
+        RefillBits(&s3);
+        if (s0.count < 56 || s1.count < 56 || s2.count < 56 || s3.count < 56)
+            break; // near the end of a stream, finish with the checked decoder
+        for (unsigned int i = 0; i < perrefill; i++, done++)
+        {
+            DecodeEntry e0 = LookupCode(table, s0.bits);
+            DecodeEntry e1 = LookupCode(table, s1.bits);
+            DecodeEntry e2 = LookupCode(table, s2.bits);
+            DecodeEntry e3 = LookupCode(table, s3.bits);
+            s0.bits >>= e0.length;
+            s1.bits >>= e1.length;
+            s2.bits >>= e2.length;
+            s3.bits >>= e3.length;
+            s0.count -= e0.length;
+            s1.count -= e1.length;
+            s2.count -= e2.length;
+            s3.count -= e3.length;
+            o0[done] = (unsigned char)e0.value;
+            o1[done] = (unsigned char)e1.value;
+            o2[done] = (unsigned char)e2.value;
+            o3[done] = (unsigned char)e3.value;
+            invalid |= (e0.length == 0) | (e1.length == 0) | (e2.length == 0) | (e3.length == 0);
+        }
+    }
+    if (invalid)
+        return -1;
+
+    if (DecodeSymbols(table, &s0, o0 + done, counts[0] - done) != 0 ||
+        DecodeSymbols(table, &s1, o1 + done, counts[1] - done) != 0 ||
+        DecodeSymbols(table, &s2, o2 + done, counts[2] - done) != 0 ||
+        DecodeSymbols(table, &s3, o3 + done, counts[3] - done) != 0)
+        return -1;
+    return 0;
+}
+
+/// @brief Decodes a block written by EncodeBlock
+/// @param ht The tree to rebuild the block's code in, reset first
+/// @param block The block, header included
+/// @param size Size of the block
+/// @param out Buffer for the decoded bytes, large enough for the whole block
+/// @param want Number of leading bytes needed. A single stream block stops decoding after them,
+/// a BLOCK_HUFFMAN4 block after the stream holding the last of them. A BLOCK_CHECKED block is always
+/// decoded whole, so its checksum can be verified
+/// @param stats Where the block's stats are added, NULL to gather none
+/// @return 0 if successful, -1 if the block is malformed or does not match its checksum
+int DecodeBlock(HuffmanTree *ht, const unsigned char *block, size_t size, unsigned char *out, size_t want,
+                BlockStats *stats)
+{
+    unsigned char lengths[BYTEMAX];
+    BitReader streams[BLOCK_STREAMS] = {0};
+    DecodeTable *table;
+    size_t rawsize, pos = BLOCK_HEADERSIZE;
+    unsigned char type;
+    int used, status = 0;
+    BlockStats local = {0};
+    uint64_t mark = stats != NULL ? GetTimeNs() : 0;
+
+    if (size < BLOCK_HEADERSIZE || (block[0] & ~BLOCK_CHECKED) > BLOCK_RLE ||
+        GetU32(block + 5) != size - BLOCK_HEADERSIZE)
+        return -1;
+    type = block[0] & ~BLOCK_CHECKED;
+    rawsize = GetU32(block + 1);
+    if (want > rawsize)
+        return -1;
+    if (block[0] & BLOCK_CHECKED)
+    {
+        if (size - pos < BLOCK_CHECKSIZE)
+            return -1;
+        pos += BLOCK_CHECKSIZE;
+        want = rawsize;
+    }
+
+    if (type == BLOCK_RAW || type == BLOCK_RLE)
+    {
+        if (size - pos != (type == BLOCK_RAW ? rawsize : 1))
+            return -1;
+        if (want != 0 && type == BLOCK_RAW)
+            memcpy(out, block + pos, want);
+        else if (want != 0)
+            memset(out, block[pos], want);
+        local.codens = Lap(stats, &mark);
+        local.codebits = type == BLOCK_RAW ? 8 * (uint64_t)want : 0;
+    }
+    else
+    {
+        used = UnpackCodeLengths(block + pos, size - pos, lengths);
+        if (used < 0)
+            return -1;
+        pos += used;
+        local.headerns = Lap(stats, &mark);
+        ResetHT(ht);
+        if (LoadCodeLengths(ht, lengths) != 0 || (table = GetDecodeTable(ht)) == NULL)
+            return -1;
+        local.buildns = Lap(stats, &mark);
+
+        if (type == BLOCK_HUFFMAN)
+        {
+            local.codebits = 8 * (uint64_t)(size - pos);
+            streams[0].buffer = block + pos;
+            streams[0].len = size - pos;
+            status = DecodeSymbols(table, &streams[0], out, want);
+        }
+        else
+        {
+            if (size - pos < BLOCK_JUMPSIZE)
+                return -1;
+            size_t jump = pos, stream = StreamLength(rawsize);
+            pos += BLOCK_JUMPSIZE;
+            local.codebits = 8 * (uint64_t)(size - pos);
+            for (int i = 0; i < BLOCK_STREAMS; i++)
+            {
+                size_t len = i < BLOCK_STREAMS - 1 ? GetU32(block + jump + 4 * i) : size - pos;
+                if (len > size - pos)
+                    return -1;
+                streams[i].buffer = block + pos;
+                streams[i].len = len;
+                pos += len;
+            }
+            if (want == rawsize && table->maxlength != 0)
+                status = DecodeInterleaved(table, streams, out, rawsize);
+            else
+            {
+                for (int i = 0; i < BLOCK_STREAMS && i * stream < want && status == 0; i++)
+                {
+                    size_t count = rawsize - i * stream < stream ? rawsize - i * stream : stream;
+                    status = DecodeSymbols(table, &streams[i], out + i * stream, count);
+                }
+            }
+        }
+        local.codens = Lap(stats, &mark);
+        if (stats != NULL)
+            AddTableStats(&local, lengths);
+    }
+
+    // checked while the block is still in cache from decoding it
+    if (status == 0 && (block[0] & BLOCK_CHECKED) && GetChecksum(out, rawsize) != GetU32(block + BLOCK_HEADERSIZE))
+        status = -1;
+    local.checksumns = Lap(stats, &mark);
+
+    if (stats != NULL && status == 0)
+    {
+        local.blocks = 1;
+        local.symbols = want;
+        local.coded = size;
+        MergeStats(stats, &local);
+    }
+    return status;
+}
+
+/// @brief Pool job that compresses job->in into job->out
+/// @param job The block
+/// @param ht The worker's tree
+void CompressBlockJob(BlockJob *job, HuffmanTree *ht)
+{
+    long size = EncodeBlock(ht, job->in, job->inlen, job->out, job->outcap, job->flags, job->measure ? &job->stats : NULL);
+    job->outlen = size < 0 ? 0 : (size_t)size;
+    job->status = size < 0 ? -1 : 0;
+}
+
+/// @brief Pool job that decodes the block in job->in, header included, into exactly job->outcap bytes
+/// @param job The block
+/// @param ht The worker's tree
+void DecompressBlockJob(BlockJob *job, HuffmanTree *ht)
+{
+    job->status = -1;
+    job->outlen = 0;
+    if (job->inlen < BLOCK_HEADERSIZE || GetU32(job->in + 1) != job->outcap)
+        return;
+    if (DecodeBlock(ht, job->in, job->inlen, job->out, job->outcap, job->measure ? &job->stats : NULL) == 0)
+    {
+        job->outlen = job->outcap;
+        job->status = 0;
+    }
+}
+
+/// @brief Thread body of a pool worker: runs queued jobs until the pool stops
+/// @param arg The BlockPool
+/// @return NULL
+void *PoolWorker(void *arg)
+{
+    BlockPool *pool = (BlockPool *)arg;
+    HuffmanTree *ht = InitHT(); // reused for every block this worker codes
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->queued == 0 && !pool->stopping)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->queued == 0)
+            break;
+        BlockJob *job = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (ht != NULL)
+            pool->run(job, ht);
+        else
+            job->status = -1;
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (ht != NULL)
+        FreeHT(ht);
+    return NULL;
+}
+
+/// @brief Starts the worker threads of a pool. With fewer than 2 threads jobs run on the calling thread
+/// @param pool The pool to start
+/// @param nthreads Number of workers
+/// @param capacity Most jobs that are ever queued or running at once
+/// @param run What the workers do with a job
+/// @return 0 if successful, -1 on failure
+int StartPool(BlockPool *pool, int nthreads, size_t capacity, BlockFunction run)
+{
+    memset(pool, 0, sizeof(BlockPool));
+    pool->run = run;
+    pool->capacity = capacity;
+    if (nthreads > POOL_MAXTHREADS)
+        nthreads = POOL_MAXTHREADS;
+    if (nthreads < 2)
+    {
+        pool->local = InitHT();
+        return pool->local == NULL ? -1 : 0;
+    }
+
+    pool->queue = (BlockJob **)malloc(capacity * sizeof(BlockJob *));
+    if (pool->queue == NULL)
+        return -1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++)
+    {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, PoolWorker, pool) != 0)
+            break;
+    }
+    return pool->nthreads == 0 ? -1 : 0;
+}
+
+/// @brief Queues a job for the workers, or runs it straight away if the pool has none
+/// @param pool The pool
+/// @param job The job to run
+void SubmitJob(BlockPool *pool, BlockJob *job)
+{
+    job->done = false;
+    if (pool->nthreads == 0)
+    {
+        pool->run(job, pool->local);
+        job->done = true;
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->queue[(pool->head + pool->queued) % pool->capacity] = job;
+    pool->queued++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/// @brief Waits until a submitted job is done
+/// @param pool The pool
+/// @param job The job to wait for
+void WaitJob(BlockPool *pool, BlockJob *job)
+{
+    if (pool->nthreads == 0)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done)
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/// @brief Lets the workers finish the queued jobs, then joins them and frees the pool
+/// @param pool The pool to stop
+void StopPool(BlockPool *pool)
+{
+    if (pool->nthreads == 0)
+    {
+        if (pool->local != NULL)
+            FreeHT(pool->local);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->queue);
+}
+
+/// @brief Compresses a stream or a mapped file as a sequence of blocks. See WriteBlocksToFile
+/// @param input The stream to compress, or NULL to compress data
+/// @param data Bytes to compress in place, used when input is NULL
+/// @param size Number of bytes in data
+/// @param output The stream to write the block container to
+/// @param blocksize Bytes per block
+/// @param nthreads Number of compression threads
+/// @param flags HT_ flags
+/// @return 0 if successful, -1 on failure
+int WriteBlocks(FILE *input, const unsigned char *data, size_t size, FILE *output, size_t blocksize, int nthreads,
+                unsigned int flags)
+{
+    unsigned char header[FORMAT_HEADERSIZE];
+    BlockPool pool;
+    BlockJob *slots;
+    unsigned char **buffers;
+    BlockIndexEntry *index = NULL;
+    uint32_t nblocks = 0, indexcap = 0;
+    uint64_t offset = FORMAT_HEADERSIZE, rawsize = 0;
+    off_t headerpos = -1;
+    size_t taken = 0;
+    int nslots, inflight = 0, status = 0;
+    bool eof = false, measure = statsHook != NULL;
+    uint64_t start = measure ? GetTimeNs() : 0;
+
+    if ((input == NULL && data == NULL && size != 0) || output == NULL || blocksize < HT_MINBLOCKSIZE ||
+        blocksize > HT_MAXBLOCKSIZE)
+        return -1;
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > POOL_MAXTHREADS)
+        nthreads = POOL_MAXTHREADS;
+
+    // two blocks per worker keeps every worker busy while the finished blocks are written
+    nslots = nthreads > 1 ? 2 * nthreads : 1;
+    slots = (BlockJob *)calloc(nslots, sizeof(BlockJob));
+    buffers = (unsigned char **)calloc(nslots, sizeof(unsigned char *));
+    if (slots == NULL || buffers == NULL)
+    {
+        free(slots);
+        free(buffers);
+        return -1;
+    }
+    for (int i = 0; i < nslots && status == 0; i++)
+    {
+        // blocks of mapped data are compressed where they are
+        buffers[i] = input != NULL ? (unsigned char *)malloc(blocksize) : NULL;
+        slots[i].outcap = BLOCK_BOUND(blocksize);
+        slots[i].flags = flags;
+        slots[i].measure = measure;
+        slots[i].out = (unsigned char *)malloc(slots[i].outcap);
+        if ((input != NULL && buffers[i] == NULL) || slots[i].out == NULL)
+            status = -1;
+    }
+    if (status == 0 && StartPool(&pool, nthreads, nslots, CompressBlockJob) != 0)
+    {
+        StopPool(&pool);
+        status = -1;
+    }
+
+    if (status == 0)
+    {
+        // a stream's size is only known at its end, and is filled in then if the output is a file
+        // that can be written at the header again
+        struct stat st;
+        PutFormatHeader(header, blocksize, input == NULL ? size : HT_UNKNOWNSIZE);
+        if (input != NULL && fstat(fileno(output), &st) == 0 && S_ISREG(st.st_mode) &&
+            (fcntl(fileno(output), F_GETFL) & O_APPEND) == 0)
+            headerpos = ftello(output);
+        if (fwrite(header, sizeof(unsigned char), FORMAT_HEADERSIZE, output) != FORMAT_HEADERSIZE)
+            status = -1;
+
+        // slots are filled and drained in the same ring order, which keeps the blocks in order
+        for (int slot = 0;; slot = (slot + 1) % nslots)
+        {
+            BlockJob *job = &slots[slot];
+            if (job->in != NULL)
+            {
+                WaitJob(&pool, job);
+                inflight--;
+                if (job->status == 0 && status == 0 && nblocks == indexcap)
+                {
+                    indexcap = indexcap == 0 ? 64 : 2 * indexcap;
+                    BlockIndexEntry *grown = (BlockIndexEntry *)realloc(index, indexcap * sizeof(BlockIndexEntry));
+                    if (grown == NULL)
+                        status = -1;
+                    index = grown == NULL ? index : grown;
+                }
+                if (job->status != 0)
+                    status = -1;
+                else if (status == 0 && fwrite(job->out, sizeof(unsigned char), job->outlen, output) != job->outlen)
+                    status = -1; // stop reading, the loop drains what is in flight
+                else if (status == 0)
+                {
+                    index[nblocks].offset = offset;
+                    index[nblocks].size = (uint32_t)job->outlen;
+                    index[nblocks].rawsize = (uint32_t)job->inlen;
+                    nblocks++;
+                    offset += job->outlen;
+                    rawsize += job->inlen;
+                }
+                job->in = NULL;
+            }
+            if (!eof && status == 0)
+            {
+                const unsigned char *block = buffers[slot];
+                size_t len;
+                if (input != NULL)
+                {
+                    len = fread(buffers[slot], sizeof(unsigned char), blocksize, input);
+                    eof = len < blocksize;
+                    if (eof && ferror(input))
+                    {
+                        status = -1;
+                        len = 0;
+                    }
+                }
+                else
+                {
+                    block = data + taken;
+                    len = size - taken < blocksize ? size - taken : blocksize;
+                    taken += len;
+                    eof = taken == size;
+                }
+                if (len != 0)
+                {
+                    job->in = block;
+                    job->inlen = len;
+                    SubmitJob(&pool, job);
+                    inflight++;
+                }
+            }
+            if (inflight == 0 && (eof || status != 0))
+                break;
+        }
+        StopPool(&pool);
+
+        unsigned char end = BLOCK_END;
+        if (status == 0 && fwrite(&end, sizeof(unsigned char), 1, output) != 1)
+            status = -1;
+
+        // the index goes last so it can be written without knowing the block count up front
+        unsigned char entry[INDEX_ENTRYSIZE];
+        for (uint32_t i = 0; i < nblocks && status == 0; i++)
+        {
+            PutU64(entry, index[i].offset);
+            PutU32(entry + 8, index[i].size);
+            PutU32(entry + 12, index[i].rawsize);
+            if (fwrite(entry, sizeof(unsigned char), INDEX_ENTRYSIZE, output) != INDEX_ENTRYSIZE)
+                status = -1;
+        }
+        PutU32(entry, nblocks);
+        memcpy(entry + 4, INDEX_MAGIC, 4);
+        if (status == 0 && fwrite(entry, sizeof(unsigned char), INDEX_TRAILERSIZE, output) != INDEX_TRAILERSIZE)
+            status = -1;
+
+        off_t tail = headerpos >= 0 && status == 0 ? ftello(output) : -1;
+        if (tail >= 0 && fseeko(output, headerpos + 8, SEEK_SET) == 0)
+        {
+            PutU64(entry, rawsize);
+            if (fwrite(entry, sizeof(unsigned char), 8, output) != 8 || fseeko(output, tail, SEEK_SET) != 0)
+                status = -1;
+        }
+        if (status == 0 && fflush(output) != 0)
+            status = -1; // a write the stream buffered failed
+    }
+
+    if (measure && status == 0)
+    {
+        BlockStats total = {0};
+        for (int i = 0; i < nslots; i++)
+            MergeStats(&total, &slots[i].stats);
+        ReportStats(true, &total, total.symbols, offset + 1 + (uint64_t)nblocks * INDEX_ENTRYSIZE + INDEX_TRAILERSIZE,
+                    start);
+    }
+    for (int i = 0; i < nslots; i++)
+    {
+        free(buffers[i]);
+        free(slots[i].out);
+    }
+    free(buffers);
+    free(slots);
+    free(index);
+    return status;
+}
+
+/// @brief Compresses a stream as a sequence of independently coded blocks, each with its own table.
+/// Blocks are compressed concurrently by nthreads workers and written out in order
+/// @param input The stream to compress, read once from its current position
+/// @param output The stream to write the block container to
+/// @param blocksize Bytes per block, HT_MINBLOCKSIZE to HT_MAXBLOCKSIZE (HT_BLOCKSIZE is a good default)
+/// @param nthreads Number of compression threads, 1 to compress on the calling thread
+/// @param flags HT_ flags, HT_INTERLEAVE for blocks that decode faster on a single core, HT_CHECKSUM for
+/// blocks whose decoded bytes are verified
+/// @return 0 if successful, -1 on failure
+int WriteBlocksToFile(FILE *input, FILE *output, size_t blocksize, int nthreads, unsigned int flags)
+{
+    if (input == NULL)
+        return -1;
+    return WriteBlocks(input, NULL, 0, output, blocksize, nthreads, flags);
+}
+
+/// @brief Checks the stored entries of a block index and loads them
+/// @param entries The stored entries
+/// @param count Number of entries
+/// @param blocksize Block size from the container header
+/// @param indexstart Position of the entries in the container, just past the end marker
+/// @param rawsize Original size from the container header, HT_UNKNOWNSIZE if not known
+/// @return the index, with raw offsets filled in, or NULL if the entries do not describe the blocks back to back
+BlockIndexEntry *ParseBlockIndex(const unsigned char *entries, uint32_t count, size_t blocksize, uint64_t indexstart,
+                                 uint64_t rawsize)
+{
+    BlockIndexEntry *index = (BlockIndexEntry *)malloc(((size_t)count + 1) * sizeof(BlockIndexEntry));
+    uint64_t offset = FORMAT_HEADERSIZE, rawoffset = 0;
+
+    if (index == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const unsigned char *entry = entries + (size_t)i * INDEX_ENTRYSIZE;
+        index[i].offset = GetU64(entry);
+        index[i].size = GetU32(entry + 8);
+        index[i].rawsize = GetU32(entry + 12);
+        index[i].rawoffset = rawoffset;
+        if (index[i].offset != offset || index[i].size < BLOCK_HEADERSIZE || index[i].size > BLOCK_BOUND(blocksize) ||
+            index[i].rawsize > blocksize)
+        {
+            free(index);
+            return NULL;
+        }
+        offset += index[i].size;
+        rawoffset += index[i].rawsize;
+    }
+    // the blocks must end right at the end marker before the index, and hold the whole original data
+    if (offset + 1 != indexstart || (rawsize != HT_UNKNOWNSIZE && rawoffset != rawsize))
+    {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+/// @brief Loads the block index from the end of a seekable container, leaving the stream where it was
+/// @param input The compressed stream, the container being the rest of the file
+/// @param start Position of the container in the stream
+/// @param blocksize Block size from the container header
+/// @param rawsize Original size from the container header
+/// @param count Set to the number of blocks
+/// @return the index, with raw offsets filled in, or NULL if the stream can not seek or has no valid index
+BlockIndexEntry *LoadBlockIndex(FILE *input, off_t start, size_t blocksize, uint64_t rawsize, uint32_t *count)
+{
+    unsigned char trailer[INDEX_TRAILERSIZE];
+    unsigned char *entries;
+    BlockIndexEntry *index = NULL;
+    off_t here, end;
+
+    here = ftello(input);
+    if (start < 0 || here < 0 || fseeko(input, 0, SEEK_END) != 0)
+        return NULL;
+    end = ftello(input);
+    if (end - start < FORMAT_HEADERSIZE + 1 + INDEX_TRAILERSIZE || fseeko(input, end - INDEX_TRAILERSIZE, SEEK_SET) != 0 ||
+        fread(trailer, sizeof(unsigned char), INDEX_TRAILERSIZE, input) != INDEX_TRAILERSIZE ||
+        memcmp(trailer + 4, INDEX_MAGIC, 4) != 0)
+    {
+        fseeko(input, here, SEEK_SET);
+        return NULL;
+    }
+    *count = GetU32(trailer);
+    uint64_t indexstart = (uint64_t)(end - start) - INDEX_TRAILERSIZE - (uint64_t)*count * INDEX_ENTRYSIZE;
+    if ((uint64_t)*count * INDEX_ENTRYSIZE > (uint64_t)(end - start) - INDEX_TRAILERSIZE - FORMAT_HEADERSIZE - 1 ||
+        fseeko(input, start + (off_t)indexstart, SEEK_SET) != 0)
+    {
+        fseeko(input, here, SEEK_SET);
+        return NULL;
+    }
+
+    entries = (unsigned char *)malloc((size_t)*count * INDEX_ENTRYSIZE + 1);
+    if (entries != NULL && fread(entries, INDEX_ENTRYSIZE, *count, input) == *count)
+        index = ParseBlockIndex(entries, *count, blocksize, indexstart, rawsize);
+    free(entries);
+    fseeko(input, here, SEEK_SET);
+    return index;
+}
+
+/// @brief Finds the block index at the end of a container held in memory
+/// @param container The container
+/// @param len Size of the container
+/// @param blocksize Block size from the container header
+/// @param rawsize Original size from the container header
+/// @param count Set to the number of blocks
+/// @return the index, with raw offsets filled in, or NULL if the container has no valid index
+BlockIndexEntry *FindBlockIndex(const unsigned char *container, size_t len, size_t blocksize, uint64_t rawsize,
+                                uint32_t *count)
+{
+    if (len < FORMAT_HEADERSIZE + 1 + INDEX_TRAILERSIZE || memcmp(container + len - 4, INDEX_MAGIC, 4) != 0)
+        return NULL;
+    *count = GetU32(container + len - INDEX_TRAILERSIZE);
+    if ((uint64_t)*count * INDEX_ENTRYSIZE > len - INDEX_TRAILERSIZE - FORMAT_HEADERSIZE - 1)
+        return NULL;
+    size_t indexstart = len - INDEX_TRAILERSIZE - (size_t)*count * INDEX_ENTRYSIZE;
+    return ParseBlockIndex(container + indexstart, *count, blocksize, indexstart, rawsize);
+}
+
+/// @brief Sizes of a run of consecutive blocks
+/// @param index Index entries of the blocks
+/// @param count Number of blocks, at least 1
+/// @param size Set to the compressed bytes of the run, block headers included
+/// @param rawsize Set to the decompressed bytes of the run
+void GetSpanSizes(const BlockIndexEntry *index, uint32_t count, size_t *size, size_t *rawsize)
+{
+    const BlockIndexEntry *last = &index[count - 1];
+    *size = (size_t)(last->offset + last->size - index[0].offset);
+    *rawsize = (size_t)(last->rawoffset + last->rawsize - index[0].rawoffset);
+}
+
+/// @brief Decodes a run of consecutive blocks on the pool, each worker writing straight into its
+/// block's place in the output
+/// @param pool Pool started with DecompressBlockJob
+/// @param jobs One job per block
+/// @param blocks The compressed bytes of the blocks, starting at the first block's header
+/// @param index Index entries of the blocks
+/// @param count Number of blocks
+/// @param out Buffer for the decompressed bytes of all the blocks
+/// @return 0 if successful, -1 if a block is malformed
+int DecodeBlockSpan(BlockPool *pool, BlockJob *jobs, const unsigned char *blocks, const BlockIndexEntry *index,
+                    uint32_t count, unsigned char *out)
+{
+    int status = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        jobs[i].in = blocks + (index[i].offset - index[0].offset);
+        jobs[i].inlen = index[i].size;
+        jobs[i].out = out + (index[i].rawoffset - index[0].rawoffset);
+        jobs[i].outcap = index[i].rawsize;
+        SubmitJob(pool, &jobs[i]);
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        WaitJob(pool, &jobs[i]);
+        if (jobs[i].status != 0)
+            status = -1;
+    }
+    return status;
+}
+
+/// @brief Decompresses an indexed container a window of blocks at a time, the blocks of a window in parallel
+/// @param input The compressed stream, positioned at the first block
+/// @param output The stream to write the decompressed bytes to
+/// @param index The container's block index
+/// @param count Number of blocks
+/// @param nthreads Number of decompression threads
+/// @param stats Where the blocks' stats are added, NULL to gather none
+/// @return 0 if successful, -1 on failure, including a short write
+int ReadIndexedBlocks(FILE *input, FILE *output, const BlockIndexEntry *index, uint32_t count, int nthreads,
+                      BlockStats *stats)
+{
+    BlockPool pool;
+    BlockJob *jobs;
+    unsigned char *blocks, *data;
+    uint32_t window = (uint32_t)nthreads * INDEX_WINDOW;
+    size_t maxsize = 0, maxrawsize = 0;
+    int status = 0;
+
+    // the buffers hold the largest window the index lists, not what the header's block size would allow
+    if (window > count)
+        window = count > 0 ? count : 1;
+    for (uint32_t first = 0; first < count; first += window)
+    {
+        size_t size, rawsize;
+        GetSpanSizes(&index[first], count - first < window ? count - first : window, &size, &rawsize);
+        maxsize = size > maxsize ? size : maxsize;
+        maxrawsize = rawsize > maxrawsize ? rawsize : maxrawsize;
+    }
+    jobs = (BlockJob *)calloc(window, sizeof(BlockJob));
+    blocks = (unsigned char *)malloc(maxsize + 1);
+    data = (unsigned char *)malloc(maxrawsize + 1);
+
+    if (jobs == NULL || blocks == NULL || data == NULL || StartPool(&pool, nthreads, window, DecompressBlockJob) != 0)
+    {
+        if (jobs != NULL && blocks != NULL && data != NULL)
+            StopPool(&pool);
+        free(jobs);
+        free(blocks);
+        free(data);
+        return -1;
+    }
+    for (uint32_t i = 0; i < window; i++)
+        jobs[i].measure = stats != NULL;
+
+    for (uint32_t first = 0; first < count && status == 0; first += window)
+    {
+        uint32_t n = count - first < window ? count - first : window;
+        size_t size, rawsize;
+        GetSpanSizes(&index[first], n, &size, &rawsize);
+
+        // the blocks are back to back, so a window is one read and one write
+        if (fread(blocks, sizeof(unsigned char), size, input) != size ||
+            DecodeBlockSpan(&pool, jobs, blocks, &index[first], n, data) != 0 ||
+            fwrite(data, sizeof(unsigned char), rawsize, output) != rawsize)
+            status = -1;
+    }
+
+    StopPool(&pool);
+    for (uint32_t i = 0; i < window && stats != NULL; i++)
+        MergeStats(stats, &jobs[i].stats);
+    free(jobs);
+    free(blocks);
+    free(data);
+    return status;
+}
+
+/// @brief Reads the next block of a container from a stream
+/// @param input The compressed stream, positioned at a block or at the end marker
+/// @param block Buffer of BLOCK_BOUND(blocksize) bytes for the block
+/// @param blocksize Block size from the container header
+/// @param size Set to the size of the block, header included
+/// @return 0 if a block was read, 1 at the end marker, -1 on a malformed or truncated block
+int ReadBlock(FILE *input, unsigned char *block, size_t blocksize, size_t *size)
+{
+    if (fread(block, sizeof(unsigned char), 1, input) != 1)
+        return -1; // container ends without an end marker
+    if (block[0] == BLOCK_END)
+        return 1;
+    if (fread(block + 1, sizeof(unsigned char), BLOCK_HEADERSIZE - 1, input) != BLOCK_HEADERSIZE - 1)
+        return -1;
+    size_t rawsize = GetU32(block + 1), payload = GetU32(block + 5);
+    if (rawsize > blocksize || payload > BLOCK_BOUND(blocksize) - BLOCK_HEADERSIZE ||
+        fread(block + BLOCK_HEADERSIZE, sizeof(unsigned char), payload, input) != payload)
+        return -1;
+    *size = BLOCK_HEADERSIZE + payload;
+    return 0;
+}
+
+/// @brief Reads past the block index that follows the end marker, so a stream holding several
+/// containers is left at the next one. A container that ends at its end marker has no index
+/// @param input The compressed stream, just past the end marker
+/// @param nblocks Number of blocks read from the container
+/// @return 0 if successful, -1 if the index does not match the blocks
+int SkipBlockIndex(FILE *input, uint32_t nblocks)
+{
+    unsigned char entry[INDEX_ENTRYSIZE];
+    int next = fgetc(input);
+
+    if (next == EOF)
+        return 0;
+    ungetc(next, input);
+    for (uint32_t i = 0; i < nblocks; i++)
+    {
+        if (fread(entry, sizeof(unsigned char), INDEX_ENTRYSIZE, input) != INDEX_ENTRYSIZE)
+            return -1;
+    }
+    if (fread(entry, sizeof(unsigned char), INDEX_TRAILERSIZE, input) != INDEX_TRAILERSIZE ||
+        GetU32(entry) != nblocks || memcmp(entry + 4, INDEX_MAGIC, 4) != 0)
+        return -1;
+    return 0;
+}
+
+/// @brief Decompresses the blocks of a container in the order they arrive, without seeking, so pipes
+/// and sockets can be decoded as they are read. The blocks are decoded on nthreads workers and a
+/// ring of slots writes them out in order, holding at most 2 blocks per worker in memory
+/// @param input The compressed stream, positioned at the first block
+/// @param output The stream to write the decompressed bytes to
+/// @param blocksize Block size from the container header
+/// @param rawsize Original size from the container header, HT_UNKNOWNSIZE if not known
+/// @param nthreads Number of decompression threads
+/// @param stats Where the blocks' stats are added, NULL to gather none
+/// @return 0 if successful, -1 on failure
+int ReadStreamedBlocks(FILE *input, FILE *output, size_t blocksize, uint64_t rawsize, int nthreads, BlockStats *stats)
+{
+    BlockPool pool;
+    BlockJob *slots;
+    unsigned char **blocks;
+    uint64_t rawtotal = 0;
+    uint32_t nblocks = 0;
+    int nslots, inflight = 0, status = 0;
+    bool end = false;
+
+    nslots = nthreads > 1 ? 2 * nthreads : 1;
+    slots = (BlockJob *)calloc(nslots, sizeof(BlockJob));
+    blocks = (unsigned char **)calloc(nslots, sizeof(unsigned char *));
+    if (slots == NULL || blocks == NULL)
+    {
+        free(slots);
+        free(blocks);
+        return -1;
+    }
+    for (int i = 0; i < nslots && status == 0; i++)
+    {
+        blocks[i] = (unsigned char *)malloc(BLOCK_BOUND(blocksize));
+        slots[i].out = (unsigned char *)malloc(blocksize);
+        slots[i].measure = stats != NULL;
+        if (blocks[i] == NULL || slots[i].out == NULL)
+            status = -1;
+    }
+    if (status == 0 && StartPool(&pool, nthreads, nslots, DecompressBlockJob) != 0)
+    {
+        StopPool(&pool);
+        status = -1;
+    }
+
+    if (status == 0)
+    {
+        for (int slot = 0;; slot = (slot + 1) % nslots)
+        {
+            BlockJob *job = &slots[slot];
+            if (job->in != NULL)
+            {
+                WaitJob(&pool, job);
+                inflight--;
+                if (job->status != 0)
+                    status = -1;
+                else if (status == 0 && fwrite(job->out, sizeof(unsigned char), job->outlen, output) != job->outlen)
+                    status = -1; // stop submitting, the loop drains what is in flight
+                job->in = NULL;
+            }
+            if (!end && status == 0)
+            {
+                size_t size;
+                int read = ReadBlock(input, blocks[slot], blocksize, &size);
+                if (read < 0)
+                    status = -1;
+                else if (read == 1)
+                    end = true;
+                else
+                {
+                    job->in = blocks[slot];
+                    job->inlen = size;
+                    job->outcap = GetU32(blocks[slot] + 1);
+                    SubmitJob(&pool, job);
+                    inflight++;
+                    nblocks++;
+                    rawtotal += job->outcap;
+                }
+            }
+            if (inflight == 0 && (end || status != 0))
+                break;
+        }
+        StopPool(&pool);
+        if (status == 0 && rawsize != HT_UNKNOWNSIZE && rawtotal != rawsize)
+            status = -1;
+        if (status == 0)
+            status = SkipBlockIndex(input, nblocks);
+    }
+
+    for (int i = 0; i < nslots; i++)
+    {
+        if (stats != NULL)
+            MergeStats(stats, &slots[i].stats);
+        free(blocks[i]);
+        free(slots[i].out);
+    }
+    free(blocks);
+    free(slots);
+    return status;
+}
+
+/// @brief Decompresses a block container written by WriteBlocksToFile on nthreads workers. When the
+/// stream can seek, the block index at the end of the container is used to read the blocks a window
+/// at a time. Otherwise the blocks are decoded as they arrive, and the stream is left past the container
+/// @param input The compressed stream, positioned at the container
+/// @param output The stream to write the decompressed bytes to
+/// @param nthreads Number of decompression threads, 1 to decode on the calling thread
+/// @return 0 if successful, -1 on a malformed container, allocation failure or failed write
+int ReadBlocksFromFile(FILE *input, FILE *output, int nthreads)
+{
+    unsigned char header[FORMAT_HEADERSIZE];
+    BlockIndexEntry *index = NULL;
+    BlockStats total = {0};
+    BlockStats *stats = statsHook != NULL ? &total : NULL;
+    uint64_t started = stats != NULL ? GetTimeNs() : 0;
+    uint64_t rawsize;
+    uint32_t count = 0;
+    size_t blocksize;
+    off_t start;
+    int status;
+
+    if (input == NULL || output == NULL)
+        return -1;
+    start = ftello(input);
+    if (fread(header, sizeof(unsigned char), FORMAT_HEADERSIZE, input) != FORMAT_HEADERSIZE ||
+        ParseFormatHeader(header, &blocksize, &rawsize) != 0)
+        return -1;
+    if (nthreads > POOL_MAXTHREADS)
+        nthreads = POOL_MAXTHREADS;
+
+    if (nthreads > 1)
+        index = LoadBlockIndex(input, start, blocksize, rawsize, &count);
+    if (index != NULL)
+    {
+        status = ReadIndexedBlocks(input, output, index, count, nthreads, stats);
+        // leave the stream past the index, as the streamed path does
+        if (status == 0 && (fgetc(input) != BLOCK_END || SkipBlockIndex(input, count) != 0))
+            status = -1;
+    }
+    else
+        status = ReadStreamedBlocks(input, output, blocksize, rawsize, nthreads, stats);
+    free(index);
+    if (status == 0 && fflush(output) != 0)
+        status = -1; // a write the stream buffered failed
+    if (stats != NULL && status == 0)
+        ReportStats(false, stats,
+                    FORMAT_HEADERSIZE + total.coded + 1 + total.blocks * INDEX_ENTRYSIZE + INDEX_TRAILERSIZE,
+                    total.symbols, started);
+    return status;
+}
+
+/// @brief Decompresses only the bytes [offset, offset + length) of a block container written by
+/// WriteBlocksToFile, decoding just the blocks that hold them and stopping at the end of the range
+/// @param input The compressed stream, positioned at the container. It must be able to seek
+/// @param offset Position of the first wanted byte in the decompressed data
+/// @param length Number of bytes wanted
+/// @param out Buffer of at least length bytes for the decompressed range
+/// @return number of bytes written to out, fewer than length if the range runs past the end of the data,
+/// or -1 if the container has no valid index or is malformed
+long ReadRangeFromFile(FILE *input, uint64_t offset, size_t length, unsigned char *out)
+{
+    unsigned char header[FORMAT_HEADERSIZE];
+    unsigned char *block = NULL, *data = NULL;
+    BlockIndexEntry *index;
+    HuffmanTree *ht = NULL;
+    uint64_t rawsize;
+    uint32_t count = 0, first = 0;
+    size_t blocksize, produced = 0;
+    off_t start;
+    int status = 0;
+
+    if (input == NULL || (out == NULL && length != 0))
+        return -1;
+    start = ftello(input);
+    if (start < 0 || fread(header, sizeof(unsigned char), FORMAT_HEADERSIZE, input) != FORMAT_HEADERSIZE ||
+        ParseFormatHeader(header, &blocksize, &rawsize) != 0)
+        return -1;
+    index = LoadBlockIndex(input, start, blocksize, rawsize, &count);
+    if (index == NULL)
+        return -1;
+
+    // the last block starting at or before the offset holds the first wanted byte
+    for (uint32_t low = 0, high = count; low < high;)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (index[mid].rawoffset <= offset)
+        {
+            first = mid;
+            low = mid + 1;
+        }
+        else
+            high = mid;
+    }
+
+    if (length != 0 && count != 0)
+    {
+        ht = InitHT();
+        block = (unsigned char *)malloc(BLOCK_BOUND(blocksize));
+        data = (unsigned char *)malloc(blocksize);
+        if (ht == NULL || block == NULL || data == NULL)
+            status = -1;
+    }
+    for (uint32_t i = first; status == 0 && produced < length && i < count; i++)
+    {
+        const BlockIndexEntry *entry = &index[i];
+        uint64_t skip = offset + produced - entry->rawoffset;
+        if (skip >= entry->rawsize)
+            break; // the range starts past the end of the data
+        size_t want = (size_t)(entry->rawsize - skip) < length - produced ? (size_t)(entry->rawsize - skip) : length - produced;
+
+        // only the symbols up to the end of the range are decoded
+        if (fseeko(input, start + (off_t)entry->offset, SEEK_SET) != 0 ||
+            fread(block, sizeof(unsigned char), entry->size, input) != entry->size ||
+            GetU32(block + 1) != entry->rawsize ||
+            DecodeBlock(ht, block, entry->size, data, (size_t)skip + want, NULL) != 0)
+        {
+            status = -1;
+            break;
+        }
+        memcpy(out + produced, data + skip, want);
+        produced += want;
+    }
+
+    if (ht != NULL)
+        FreeHT(ht);
+    free(block);
+    free(data);
+    free(index);
+    return status == 0 ? (long)produced : -1;
+}
+
+#pragma endregion Blocks
+
+#pragma region Buffers
+
+/// @brief Worst case size of the block container WriteBlocksToBuffer makes of len bytes
+/// @param len Number of bytes to compress
+/// @return the size to give the output buffer
+size_t GetCompressBound(size_t len)
+{
+    size_t nblocks = (len + HT_BLOCKSIZE - 1) / HT_BLOCKSIZE;
+    return FORMAT_HEADERSIZE + nblocks * (BLOCK_BOUND(0) + INDEX_ENTRYSIZE) + len + 1 + INDEX_TRAILERSIZE;
+}
+
+/// @brief Compresses a buffer into a block container in a caller provided buffer, the same container
+/// WriteBlocksToFile writes. The blocks are coded straight from the input into the output, without
+/// allocating or touching stdio
+/// @param input The bytes to compress
+/// @param len Number of bytes
+/// @param output Buffer for the container, GetCompressBound(len) bytes always fit it
+/// @param cap Size of output
+/// @param flags HT_ flags, as for WriteBlocksToFile
+/// @return size of the container, or -1 if it does not fit in cap bytes
+long WriteBlocksToBuffer(const void *input, size_t len, void *output, size_t cap, unsigned int flags)
+{
+    const unsigned char *in = (const unsigned char *)input;
+    unsigned char *out = (unsigned char *)output;
+    HuffmanTree ht = {0};
+    size_t pos = FORMAT_HEADERSIZE, blockpos = FORMAT_HEADERSIZE;
+    uint32_t nblocks = 0;
+    BlockStats total = {0};
+    BlockStats *stats = statsHook != NULL ? &total : NULL;
+    uint64_t start = stats != NULL ? GetTimeNs() : 0;
+
+    if ((in == NULL && len != 0) || out == NULL || cap < FORMAT_HEADERSIZE)
+        return -1;
+    PutFormatHeader(out, HT_BLOCKSIZE, len);
+
+    for (size_t done = 0; done < len; done += HT_BLOCKSIZE, nblocks++)
+    {
+        size_t n = len - done < HT_BLOCKSIZE ? len - done : HT_BLOCKSIZE;
+        long size = EncodeBlock(&ht, in + done, n, out + pos, cap - pos, flags, stats);
+        if (size < 0)
+            return -1;
+        pos += size;
+    }
+    if (cap - pos < 1 + (size_t)nblocks * INDEX_ENTRYSIZE + INDEX_TRAILERSIZE)
+        return -1;
+    out[pos++] = BLOCK_END;
+
+    // the index is rebuilt from the block headers rather than kept on the side
+    for (uint32_t i = 0; i < nblocks; i++, pos += INDEX_ENTRYSIZE)
+    {
+        uint32_t size = BLOCK_HEADERSIZE + GetU32(out + blockpos + 5);
+        PutU64(out + pos, blockpos);
+        PutU32(out + pos + 8, size);
+        PutU32(out + pos + 12, GetU32(out + blockpos + 1));
+        blockpos += size;
+    }
+    PutU32(out + pos, nblocks);
+    memcpy(out + pos + 4, INDEX_MAGIC, 4);
+    pos += INDEX_TRAILERSIZE;
+    if (stats != NULL)
+        ReportStats(true, stats, len, pos, start);
+    return (long)pos;
+}
+
+/// @brief Checks the block index that follows the end marker of a container held in memory, as
+/// SkipBlockIndex does for a stream, so a container cut inside its index is not taken for a whole one.
+/// A container that ends at its end marker has no index
+/// @param in The container
+/// @param len Size of the container
+/// @param pos Position just past the end marker
+/// @param nblocks Number of blocks before the end marker
+/// @return 0 if successful, -1 if the index is cut short or does not match the blocks
+int CheckBufferIndex(const unsigned char *in, size_t len, size_t pos, uint32_t nblocks)
+{
+    const unsigned char *trailer;
+
+    if (pos == len)
+        return 0;
+    if ((uint64_t)nblocks * INDEX_ENTRYSIZE + INDEX_TRAILERSIZE > len - pos)
+        return -1;
+    trailer = in + pos + (size_t)nblocks * INDEX_ENTRYSIZE;
+    if (GetU32(trailer) != nblocks || memcmp(trailer + 4, INDEX_MAGIC, 4) != 0)
+        return -1;
+    return 0;
+}
+
+/// @brief Size a block container held in memory decompresses to, so the output buffer of
+/// ReadBlocksFromBuffer can be sized first. Summed from the block headers, and checked against the
+/// container header when the writer knew it, so a header alone can not ask for more memory than its blocks hold
+/// @param input The container
+/// @param len Size of the container
+/// @return the decompressed size, or -1 if the container is malformed
+long GetDecompressedSize(const void *input, size_t len)
+{
+    const unsigned char *in = (const unsigned char *)input;
+    size_t blocksize, pos = FORMAT_HEADERSIZE;
+    uint32_t nblocks = 0;
+    uint64_t rawsize, total = 0;
+
+    if (in == NULL || len < FORMAT_HEADERSIZE || ParseFormatHeader(in, &blocksize, &rawsize) != 0)
+        return -1;
+    for (;;)
+    {
+        if (pos == len)
+            return -1; // container ends without an end marker
+        if (in[pos] == BLOCK_END)
+            break;
+        if (len - pos < BLOCK_HEADERSIZE)
+            return -1;
+        size_t size = BLOCK_HEADERSIZE + (size_t)GetU32(in + pos + 5);
+        if (size > len - pos)
+            return -1;
+        total += GetU32(in + pos + 1);
+        pos += size;
+        nblocks++;
+    }
+    if ((rawsize != HT_UNKNOWNSIZE && total != rawsize) || total > LONG_MAX ||
+        CheckBufferIndex(in, len, pos + 1, nblocks) != 0)
+        return -1;
+    return (long)total;
+}
+
+/// @brief Decompresses a block container held in memory into a caller provided buffer. The tree and
+/// decode tables live on the stack, so nothing is allocated
+/// @param input The container
+/// @param len Size of the container
+/// @param output Buffer for the decompressed bytes
+/// @param cap Size of output
+/// @return number of decompressed bytes, or -1 if the container is malformed, uses codes longer than
+/// HT_MAXCODELEN or does not fit in cap bytes
+long ReadBlocksFromBuffer(const void *input, size_t len, void *output, size_t cap)
+{
+    const unsigned char *in = (const unsigned char *)input;
+    unsigned char *out = (unsigned char *)output;
+    HuffmanTree ht = {0};
+    DecodeTable table;
+    DecodeEntry sub[DECODE_FIXEDSUB];
+    size_t blocksize, pos = FORMAT_HEADERSIZE, produced = 0;
+    uint32_t nblocks = 0;
+    uint64_t expected;
+    BlockStats total = {0};
+    BlockStats *stats = statsHook != NULL ? &total : NULL;
+    uint64_t start = stats != NULL ? GetTimeNs() : 0;
+
+    if (in == NULL || (out == NULL && cap != 0) || len < FORMAT_HEADERSIZE ||
+        ParseFormatHeader(in, &blocksize, &expected) != 0)
+        return -1;
+    if (expected != HT_UNKNOWNSIZE && expected > cap)
+        return -1; // known not to fit before decoding anything
+
+    table.sub = sub;
+    table.subcapacity = DECODE_FIXEDSUB;
+    table.ready = false;
+    table.fixed = true;
+    ht.decoder = &table;
+
+    // each block decodes straight into its place in the output
+    for (;;)
+    {
+        if (pos == len)
+            return -1; // container ends without an end marker
+        if (in[pos] == BLOCK_END)
+            break;
+        if (len - pos < BLOCK_HEADERSIZE)
+            return -1;
+        size_t rawsize = GetU32(in + pos + 1), size = BLOCK_HEADERSIZE + (size_t)GetU32(in + pos + 5);
+        if (rawsize > blocksize || size > len - pos || rawsize > cap - produced ||
+            DecodeBlock(&ht, in + pos, size, out + produced, rawsize, stats) != 0)
+            return -1;
+        pos += size;
+        produced += rawsize;
+        nblocks++;
+    }
+    if ((expected != HT_UNKNOWNSIZE && produced != expected) || CheckBufferIndex(in, len, pos + 1, nblocks) != 0)
+        return -1;
+    if (stats != NULL)
+        ReportStats(false, stats, len, produced, start);
+    return (long)produced;
+}
+
+#pragma endregion Buffers
+
+#pragma endregion Private Functions
+
+#pragma region Streams
+
+/// @brief Makes an incremental codec context. Compression writes and decompression reads the same
+/// block container as WriteBlocksToFile, a block at most HT_BLOCKSIZE bytes
+/// @param compress true to compress, false to decompress
+/// @param flags HT_ flags of the blocks compressed, ignored when decompressing
+/// @return the context, or NULL if out of memory
+HTStream *InitHTStream(bool compress, unsigned int flags)
+{
+    HTStream *hs = (HTStream *)calloc(1, sizeof(HTStream));
+
+    if (hs == NULL)
+        return NULL;
+    hs->compress = compress;
+    hs->flags = flags;
+    hs->ht = InitHT();
+    if (compress && hs->ht != NULL)
+    {
+        hs->blocksize = HT_BLOCKSIZE;
+        hs->block = (unsigned char *)malloc(HT_BLOCKSIZE);
+        hs->pendingcap = FORMAT_HEADERSIZE + BLOCK_BOUND(HT_BLOCKSIZE);
+        hs->pending = (unsigned char *)malloc(hs->pendingcap);
+    }
+    if (hs->ht == NULL || (compress && (hs->block == NULL || hs->pending == NULL)))
+    {
+        FreeHTStream(hs);
+        return NULL;
+    }
+    ResetHTStream(hs);
+    return hs;
+}
+
+/// @brief Readies a context for a new container, keeping its allocations
+/// @param hs The context
+void ResetHTStream(HTStream *hs)
+{
+    hs->state = STREAM_HEADER;
+    hs->headerlen = 0;
+    hs->blocklen = 0;
+    hs->pendingpos = 0;
+    hs->pendinglen = 0;
+    hs->nblocks = 0;
+    hs->offset = 0;
+    hs->count = 0;
+    hs->bits = 0;
+    hs->started = 0;
+    hs->bytesin = 0;
+    hs->bytesout = 0;
+    memset(&hs->stats, 0, sizeof(BlockStats));
+}
+
+/// @brief Frees a context
+/// @param hs The context, may be NULL
+void FreeHTStream(HTStream *hs)
+{
+    if (hs == NULL)
+        return;
+    if (hs->ht != NULL)
+        FreeHT(hs->ht);
+    free(hs->block);
+    free(hs->pending);
+    free(hs->index);
+    free(hs);
+}
+
+/// @brief Makes room for n more bytes of pending output
+/// @param hs The context
+/// @param n Number of bytes
+/// @return 0 if successful, -1 if out of memory
+int ReservePending(HTStream *hs, size_t n)
+{
+    if (hs->pendinglen + n <= hs->pendingcap)
+        return 0;
+    unsigned char *grown = (unsigned char *)realloc(hs->pending, hs->pendinglen + n);
+    if (grown == NULL)
+        return -1;
+    hs->pending = grown;
+    hs->pendingcap = hs->pendinglen + n;
+    return 0;
+}
+
+/// @brief Copies as much pending output as fits into the output buffer
+/// @param hs The context
+/// @param out The output buffer
+/// @param outcap Size of out
+/// @param outpos Position in out, advanced past the copied bytes
+/// @return true once nothing is pending
+bool DrainPending(HTStream *hs, unsigned char *out, size_t outcap, size_t *outpos)
+{
+    size_t n = hs->pendinglen - hs->pendingpos;
+
+    if (n > outcap - *outpos)
+        n = outcap - *outpos;
+    if (n != 0)
+    {
+        memcpy(out + *outpos, hs->pending + hs->pendingpos, n);
+        *outpos += n;
+        hs->pendingpos += n;
+    }
+    if (hs->pendingpos < hs->pendinglen)
+        return false;
+    hs->pendingpos = 0;
+    hs->pendinglen = 0;
+    return true;
+}
+
+/// @brief Compresses the gathered input into a block of pending output and records it in the index
+/// @param hs The compressing context
+/// @return 0 if successful, -1 on failure
+int EmitStreamBlock(HTStream *hs)
+{
+    if (hs->nblocks == hs->indexcap)
+    {
+        uint32_t cap = hs->indexcap == 0 ? 64 : 2 * hs->indexcap;
+        BlockIndexEntry *grown = (BlockIndexEntry *)realloc(hs->index, cap * sizeof(BlockIndexEntry));
+        if (grown == NULL)
+            return -1;
+        hs->index = grown;
+        hs->indexcap = cap;
+    }
+    if (ReservePending(hs, BLOCK_BOUND(hs->blocklen)) != 0)
+        return -1;
+    long size = EncodeBlock(hs->ht, hs->block, hs->blocklen, hs->pending + hs->pendinglen,
+                            hs->pendingcap - hs->pendinglen, hs->flags, hs->started != 0 ? &hs->stats : NULL);
+    if (size < 0)
+        return -1;
+    hs->index[hs->nblocks].offset = hs->offset;
+    hs->index[hs->nblocks].size = (uint32_t)size;
+    hs->index[hs->nblocks].rawsize = (uint32_t)hs->blocklen;
+    hs->nblocks++;
+    hs->offset += size;
+    hs->pendinglen += size;
+    hs->blocklen = 0;
+    return 0;
+}
+
+/// @brief Compressing half of FeedHTStream
+int FeedCompressor(HTStream *hs, const unsigned char *in, size_t inlen, size_t *inpos, unsigned char *out,
+                   size_t outcap, size_t *outpos, int mode)
+{
+    for (;;)
+    {
+        if (!DrainPending(hs, out, outcap, outpos))
+            return 0; // out of room
+        if (hs->state == STREAM_DONE)
+            return HT_STREAMEND;
+        if (hs->state == STREAM_HEADER)
+        {
+            PutFormatHeader(hs->pending, hs->blocksize, HT_UNKNOWNSIZE);
+            hs->pendinglen = FORMAT_HEADERSIZE;
+            hs->offset = FORMAT_HEADERSIZE;
+            hs->state = STREAM_BLOCK;
+            continue;
+        }
+
+        size_t n = inlen - *inpos < hs->blocksize - hs->blocklen ? inlen - *inpos : hs->blocksize - hs->blocklen;
+        if (n != 0)
+            memcpy(hs->block + hs->blocklen, in + *inpos, n);
+        hs->blocklen += n;
+        *inpos += n;
+        if (hs->blocklen == hs->blocksize || (mode != HT_RUN && *inpos == inlen && hs->blocklen != 0))
+        { // a flush sends what has been gathered as a short block
+            if (EmitStreamBlock(hs) != 0)
+                return -1;
+            continue;
+        }
+        if (mode != HT_FINISH || *inpos != inlen)
+            return 0; // needs more input
+
+        // finishing: the end marker, then the index
+        if (ReservePending(hs, 1 + (size_t)hs->nblocks * INDEX_ENTRYSIZE + INDEX_TRAILERSIZE) != 0)
+            return -1;
+        unsigned char *end = hs->pending + hs->pendinglen;
+        *end++ = BLOCK_END;
+        for (uint32_t i = 0; i < hs->nblocks; i++, end += INDEX_ENTRYSIZE)
+        {
+            PutU64(end, hs->index[i].offset);
+            PutU32(end + 8, hs->index[i].size);
+            PutU32(end + 12, hs->index[i].rawsize);
+        }
+        PutU32(end, hs->nblocks);
+        memcpy(end + 4, INDEX_MAGIC, 4);
+        hs->pendinglen = end + INDEX_TRAILERSIZE - hs->pending;
+        hs->state = STREAM_DONE;
+    }
+}
+
+/// @brief Gathers bytes into the context's header buffer
+/// @return true once want bytes are gathered
+bool GatherHeader(HTStream *hs, size_t want, const unsigned char *in, size_t inlen, size_t *inpos)
+{
+    size_t n = inlen - *inpos < want - hs->headerlen ? inlen - *inpos : want - hs->headerlen;
+
+    if (n != 0)
+        memcpy(hs->header + hs->headerlen, in + *inpos, n);
+    hs->headerlen += n;
+    *inpos += n;
+    return hs->headerlen == want;
+}
+
+/// @brief Decompressing half of FeedHTStream
+int FeedDecompressor(HTStream *hs, const unsigned char *in, size_t inlen, size_t *inpos, unsigned char *out,
+                     size_t outcap, size_t *outpos)
+{
+    for (;;)
+    {
+        if (!DrainPending(hs, out, outcap, outpos))
+            return 0; // out of room
+
+        switch (hs->state)
+        {
+        case STREAM_HEADER:
+        {
+            if (!GatherHeader(hs, FORMAT_HEADERSIZE, in, inlen, inpos))
+                return 0;
+            size_t blocksize;
+            if (ParseFormatHeader(hs->header, &blocksize, &hs->rawsize) != 0)
+                return -1;
+            hs->rawtotal = 0;
+            if (blocksize > hs->blocksize)
+            { // a reused context keeps the larger buffers
+                free(hs->block);
+                free(hs->pending);
+                hs->block = (unsigned char *)malloc(BLOCK_BOUND(blocksize));
+                hs->pending = (unsigned char *)malloc(blocksize);
+                hs->blocksize = hs->block == NULL || hs->pending == NULL ? 0 : blocksize;
+                hs->pendingcap = hs->blocksize;
+                if (hs->blocksize == 0)
+                    return -1;
+            }
+            hs->headerlen = 0;
+            hs->state = STREAM_BLOCK;
+            break;
+        }
+        case STREAM_BLOCK:
+        {
+            if (*inpos < inlen && hs->headerlen == 0 && in[*inpos] == BLOCK_END)
+            {
+                if (hs->rawsize != HT_UNKNOWNSIZE && hs->rawtotal != hs->rawsize)
+                    return -1;
+                (*inpos)++;
+                hs->skip = (size_t)hs->nblocks * INDEX_ENTRYSIZE;
+                hs->state = STREAM_INDEX;
+                break;
+            }
+            if (!GatherHeader(hs, BLOCK_HEADERSIZE, in, inlen, inpos))
+                return 0;
+            hs->headerlen = 0;
+            hs->remaining = GetU32(hs->header + 1);
+            hs->payloadleft = GetU32(hs->header + 5);
+            if ((hs->header[0] & ~BLOCK_CHECKED) > BLOCK_RLE || hs->remaining > hs->blocksize ||
+                hs->payloadleft > BLOCK_BOUND(hs->blocksize) - BLOCK_HEADERSIZE)
+                return -1;
+            hs->nblocks++;
+            hs->rawtotal += hs->remaining;
+            if (hs->header[0] != BLOCK_HUFFMAN)
+            { // the 4 streams follow one another, stored blocks are copied whole and no byte of a checked
+              // block is handed out before it is verified, so these blocks are decoded once they are all here
+                memcpy(hs->block, hs->header, BLOCK_HEADERSIZE);
+                hs->blocklen = BLOCK_HEADERSIZE;
+                hs->state = STREAM_PAYLOAD;
+            }
+            else
+            {
+                hs->stagelen = 0;
+                hs->state = STREAM_LENGTHS;
+            }
+            break;
+        }
+        case STREAM_LENGTHS:
+        {
+            unsigned char lengths[BYTEMAX];
+            // as much of the payload as the longest code length header, less what is already staged
+            size_t payload = hs->payloadleft + hs->stagelen;
+            size_t want = (payload < LENGTHS_MAXSIZE ? payload : LENGTHS_MAXSIZE) - hs->stagelen;
+            size_t n = inlen - *inpos < want ? inlen - *inpos : want;
+            if (n != 0)
+                memcpy(hs->stage + hs->stagelen, in + *inpos, n);
+            hs->stagelen += n;
+            hs->payloadleft -= n;
+            *inpos += n;
+            if (n < want)
+                return 0;
+
+            // the codes that came in behind the lengths stay staged until they are decoded
+            BlockStats *stats = hs->started != 0 ? &hs->stats : NULL;
+            uint64_t mark = stats != NULL ? GetTimeNs() : 0;
+            int used = UnpackCodeLengths(hs->stage, hs->stagelen, lengths);
+            hs->stats.headerns += Lap(stats, &mark);
+            ResetHT(hs->ht);
+            if (used < 0 || LoadCodeLengths(hs->ht, lengths) != 0 || (hs->table = GetDecodeTable(hs->ht)) == NULL)
+                return -1;
+            if (stats != NULL)
+            { // the codes are decoded as they arrive, so their time is not counted
+                stats->buildns += Lap(stats, &mark);
+                stats->blocks++;
+                stats->symbols += hs->remaining;
+                stats->coded += BLOCK_HEADERSIZE + hs->payloadleft + hs->stagelen;
+                stats->codebits += 8 * (uint64_t)(hs->payloadleft + hs->stagelen - used);
+                AddTableStats(stats, lengths);
+            }
+            hs->stagepos = used;
+            hs->bits = 0;
+            hs->count = 0;
+            hs->state = STREAM_CODES;
+            break;
+        }
+        case STREAM_CODES:
+        {
+            const DecodeTable *table = hs->table;
+            while (hs->remaining > 0 && *outpos < outcap)
+            {
+                while (hs->count <= 56)
+                {
+                    uint64_t byte;
+                    if (hs->stagepos < hs->stagelen)
+                        byte = hs->stage[hs->stagepos++];
+                    else if (hs->payloadleft > 0 && *inpos < inlen)
+                    {
+                        byte = in[(*inpos)++];
+                        hs->payloadleft--;
+                    }
+                    else
+                        break;
+                    hs->bits |= byte << hs->count;
+                    hs->count += 8;
+                }
+                // a code may still be arriving unless the payload is all in
+                if (hs->count < table->maxlength && (hs->stagepos < hs->stagelen || hs->payloadleft > 0))
+                    return 0;
+                DecodeEntry entry = LookupCode(table, hs->bits);
+                if (entry.length == 0 || entry.length > hs->count)
+                    return -1;
+                hs->bits >>= entry.length;
+                hs->count -= entry.length;
+                out[(*outpos)++] = (unsigned char)entry.value;
+                hs->remaining--;
+            }
+            if (hs->remaining > 0)
+                return 0; // out of room
+            hs->skip = hs->payloadleft; // padding after the last code
+            hs->state = STREAM_SKIP;
+            break;
+        }
+        case STREAM_PAYLOAD:
+        {
+            size_t n = inlen - *inpos < hs->payloadleft ? inlen - *inpos : hs->payloadleft;
+            if (n != 0)
+                memcpy(hs->block + hs->blocklen, in + *inpos, n);
+            hs->blocklen += n;
+            hs->payloadleft -= n;
+            *inpos += n;
+            if (hs->payloadleft > 0)
+                return 0;
+            if (DecodeBlock(hs->ht, hs->block, hs->blocklen, hs->pending, hs->remaining,
+                            hs->started != 0 ? &hs->stats : NULL) != 0)
+                return -1;
+            hs->pendinglen = hs->remaining;
+            hs->state = STREAM_BLOCK;
+            break;
+        }
+        case STREAM_SKIP:
+        case STREAM_INDEX:
+        {
+            size_t n = inlen - *inpos < hs->skip ? inlen - *inpos : hs->skip;
+            *inpos += n;
+            hs->skip -= n;
+            if (hs->skip > 0)
+                return 0;
+            hs->state = hs->state == STREAM_SKIP ? STREAM_BLOCK : STREAM_TRAILER;
+            break;
+        }
+        case STREAM_TRAILER:
+            if (!GatherHeader(hs, INDEX_TRAILERSIZE, in, inlen, inpos))
+                return 0;
+            if (GetU32(hs->header) != hs->nblocks || memcmp(hs->header + 4, INDEX_MAGIC, 4) != 0)
+                return -1;
+            hs->state = STREAM_DONE;
+            break;
+        default:
+            return HT_STREAMEND;
+        }
+    }
+}
+
+/// @brief Compresses or decompresses as much as the input and output buffers allow, like a z_stream.
+/// Whatever can not be finished is kept in the context and carried on by the next call
+/// @param hs The context
+/// @param in Input bytes
+/// @param inlen Number of input bytes
+/// @param consumed Set to the number of input bytes taken
+/// @param out Output buffer
+/// @param outcap Size of out
+/// @param produced Set to the number of bytes written to out
+/// @param mode When compressing, HT_RUN to gather input into full blocks, HT_FLUSH to also send the input
+/// gathered so far as a block, HT_FINISH to end the container once the input is taken. Ignored when decompressing
+/// @return HT_STREAMEND once the whole container has been produced or decoded, 0 if more input or output room
+/// is needed, -1 on malformed input or allocation failure
+int FeedHTStream(HTStream *hs, const void *in, size_t inlen, size_t *consumed, void *out, size_t outcap, size_t *produced,
+                 int mode)
+{
+    size_t inpos = 0, outpos = 0;
+    int status;
+
+    if (hs == NULL || (in == NULL && inlen != 0) || (out == NULL && outcap != 0))
+        return -1;
+    if (hs->started == 0 && hs->state != STREAM_DONE && statsHook != NULL)
+        hs->started = GetTimeNs();
+    if (hs->compress)
+        status = FeedCompressor(hs, (const unsigned char *)in, inlen, &inpos, (unsigned char *)out, outcap, &outpos, mode);
+    else
+        status = FeedDecompressor(hs, (const unsigned char *)in, inlen, &inpos, (unsigned char *)out, outcap, &outpos);
+    hs->bytesin += inpos;
+    hs->bytesout += outpos;
+    if (status == HT_STREAMEND && hs->started != 0)
+    { // reported once, on the call that ends the container
+        ReportStats(hs->compress, &hs->stats, hs->bytesin, hs->bytesout, hs->started);
+        hs->started = 0;
+    }
+    if (consumed != NULL)
+        *consumed = inpos;
+    if (produced != NULL)
+        *produced = outpos;
+    return status;
+}
+
+#pragma endregion Streams
+
+#pragma region Dictionaries
+
+/// @brief Builds the encode and decode tables of a dictionary from its code lengths
+/// @param dict The dictionary, with id and lengths set
+/// @return 0 if successful, -1 if the lengths are not a complete code for every byte value
+int PrepareHTDictionary(HTDictionary *dict)
+{
+    uint64_t kraft = 0;
+
+    for (int value = 0; value < BYTEMAX; value++)
+    {
+        if (dict->lengths[value] == 0 || dict->lengths[value] > HT_MAXCODELEN)
+            return -1; // every byte a message may hold needs a code
+        kraft += (uint64_t)1 << (HT_MAXCODELEN - dict->lengths[value]);
+    }
+    // a trained code fills the code space, so lengths that leave part of it unused were damaged
+    if (kraft != (uint64_t)1 << HT_MAXCODELEN)
+        return -1;
+    dict->ht = InitHT();
+    if (dict->ht == NULL || LoadCodeLengths(dict->ht, dict->lengths) != 0 ||
+        (dict->decoder = GetDecodeTable(dict->ht)) == NULL)
+        return -1;
+    BuildEncodeTable(dict->ht, dict->encoder);
+    return 0;
+}
+
+/// @brief Trains a dictionary on sample messages. Every byte value is counted once more than it was seen,
+/// so the table can code bytes the samples never held
+/// @param samples Sample messages, back to back
+/// @param len Size of the samples
+/// @param id The id messages coded with the dictionary carry
+/// @return the dictionary, or NULL on failure
+HTDictionary *TrainHTDictionary(const void *samples, size_t len, uint32_t id)
+{
+    uint64_t counts[BYTEMAX] = {0};
+    HTDictionary *dict = (HTDictionary *)calloc(1, sizeof(HTDictionary));
+    HuffmanTree *ht = InitHT();
+
+    if (dict == NULL || ht == NULL || (samples == NULL && len != 0))
+    {
+        free(dict);
+        if (ht != NULL)
+            FreeHT(ht);
+        return NULL;
+    }
+    CountSymbols((const unsigned char *)samples, len, counts);
+    NormalizeCounts(counts, DICT_TRAINBITS);
+    for (int value = 0; value < BYTEMAX; value++)
+        counts[value]++;
+
+    dict->id = id;
+    LoadLeafNodes(ht, counts);
+    if (BuildHTFromFrequencies(ht, HT_MAXCODELEN) == 0)
+    {
+        for (int i = 0; i < ht->count; i++)
+        {
+            if (ht->tree[i].left == HT_NONE)
+                dict->lengths[ht->tree[i].value] = ht->tree[i].codelength;
+        }
+    }
+    FreeHT(ht);
+    if (PrepareHTDictionary(dict) != 0)
+    {
+        FreeHTDictionary(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+/// @brief Saves a dictionary so the other side can load it: magic, version, id, then its code lengths
+/// @param dict The dictionary
+/// @param out Buffer for the saved dictionary, HT_DICTSAVESIZE bytes always fit it
+/// @param cap Size of out
+/// @return size of the saved dictionary, or -1 if it does not fit
+long SaveHTDictionary(const HTDictionary *dict, void *out, size_t cap)
+{
+    unsigned char *bytes = (unsigned char *)out;
+    unsigned char lengths[LENGTHS_MAXSIZE];
+    int size = PackCodeLengths(dict->lengths, lengths);
+
+    if (cap < DICT_HEADERSIZE + (size_t)size)
+        return -1;
+    memcpy(bytes, DICT_MAGIC, 3);
+    bytes[3] = DICT_VERSION;
+    PutU32(bytes + 4, dict->id);
+    memcpy(bytes + DICT_HEADERSIZE, lengths, size);
+    return DICT_HEADERSIZE + size;
+}
+
+/// @brief Loads a dictionary saved by SaveHTDictionary and builds its tables
+/// @param in The saved dictionary
+/// @param len Size of the saved dictionary
+/// @return the dictionary, or NULL if it is malformed or out of memory
+HTDictionary *LoadHTDictionary(const void *in, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)in;
+    HTDictionary *dict;
+
+    if (bytes == NULL || len < DICT_HEADERSIZE || memcmp(bytes, DICT_MAGIC, 3) != 0 || bytes[3] != DICT_VERSION)
+        return NULL;
+    dict = (HTDictionary *)calloc(1, sizeof(HTDictionary));
+    if (dict == NULL)
+        return NULL;
+    dict->id = GetU32(bytes + 4);
+    if (UnpackCodeLengths(bytes + DICT_HEADERSIZE, len - DICT_HEADERSIZE, dict->lengths) < 0 ||
+        PrepareHTDictionary(dict) != 0)
+    {
+        FreeHTDictionary(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+/// @brief Frees a dictionary
+/// @param dict The dictionary, may be NULL
+void FreeHTDictionary(HTDictionary *dict)
+{
+    if (dict == NULL)
+        return;
+    if (dict->ht != NULL)
+        FreeHT(dict->ht);
+    free(dict);
+}
+
+/// @brief Id of the dictionary a message was coded with, for picking it out of those loaded
+/// @param in The message
+/// @param len Size of the message
+/// @return the id, or -1 if the message is malformed
+long GetHTDictionaryID(const void *in, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)in;
+    uint64_t id;
+
+    if (bytes == NULL || len < 1 || (bytes[0] != DICT_CODED && bytes[0] != DICT_STORED) ||
+        GetVarint(bytes + 1, len - 1, &id) < 0 || id > UINT32_MAX)
+        return -1;
+    return (long)id;
+}
+
+/// @brief Compresses a message with a dictionary's prebuilt table. The header is a tag byte, then the
+/// dictionary id and the message size as varints, 3 bytes for small ids and messages. Messages the
+/// table would not shrink are stored as they are
+/// @param dict The dictionary
+/// @param in The message
+/// @param len Size of the message
+/// @param out Buffer for the compressed message, HT_DICTBOUND(len) bytes always fit it
+/// @param cap Size of out
+/// @return size of the compressed message, or -1 if it does not fit
+long CompressWithHTDictionary(const HTDictionary *dict, const void *in, size_t len, void *out, size_t cap)
+{
+    unsigned char header[1 + 2 * 10];
+    unsigned char *bytes = (unsigned char *)out;
+    size_t headerlen = 1;
+
+    if (dict == NULL || (in == NULL && len != 0) || out == NULL || len > UINT32_MAX)
+        return -1;
+    headerlen += PutVarint(header + headerlen, dict->id);
+    headerlen += PutVarint(header + headerlen, len);
+    if (cap < headerlen)
+        return -1;
+
+    // coded only if it comes out smaller than the message itself
+    size_t room = cap - headerlen < len ? cap - headerlen : len;
+    long size = EncodeStream(dict->encoder, (const unsigned char *)in, len, bytes + headerlen, room);
+    if (size >= 0 && (size_t)size < len)
+        header[0] = DICT_CODED;
+    else if (cap - headerlen >= len)
+    {
+        header[0] = DICT_STORED;
+        if (len != 0)
+            memcpy(bytes + headerlen, in, len);
+        size = (long)len;
+    }
+    else
+        return -1;
+    memcpy(bytes, header, headerlen);
+    return (long)headerlen + size;
+}
+
+/// @brief Decompresses a message compressed by CompressWithHTDictionary
+/// @param dict The dictionary the message was coded with
+/// @param in The compressed message
+/// @param len Size of the compressed message
+/// @param out Buffer for the message
+/// @param cap Size of out
+/// @return size of the message, or -1 if it is malformed, names another dictionary or does not fit
+long DecompressWithHTDictionary(const HTDictionary *dict, const void *in, size_t len, void *out, size_t cap)
+{
+    const unsigned char *bytes = (const unsigned char *)in;
+    BitReader reader = {0};
+    uint64_t id, rawsize;
+    size_t pos = 1;
+    int used;
+
+    if (dict == NULL || bytes == NULL || len < 1 || (bytes[0] != DICT_CODED && bytes[0] != DICT_STORED))
+        return -1;
+    if ((used = GetVarint(bytes + pos, len - pos, &id)) < 0 || id != dict->id)
+        return -1;
+    pos += used;
+    if ((used = GetVarint(bytes + pos, len - pos, &rawsize)) < 0 || rawsize > cap || (out == NULL && rawsize != 0))
+        return -1;
+    pos += used;
+
+    if (bytes[0] == DICT_STORED)
+    {
+        if (len - pos != rawsize)
+            return -1;
+        if (rawsize != 0)
+            memcpy(out, bytes + pos, rawsize);
+        return (long)rawsize;
+    }
+    reader.buffer = bytes + pos;
+    reader.len = len - pos;
+    if (DecodeSymbols(dict->decoder, &reader, (unsigned char *)out, rawsize) != 0)
+        return -1;
+    return (long)rawsize;
+}
+
+#pragma endregion Dictionaries
+
+#pragma region Wide
+
+/// @brief Compares two 64 bit sort keys
+/// @param key1 The first key
+/// @param key2 The second key
+/// @return 1 if K1 > K2, -1 if K1 < K2, 0 if K1 == K2
+int CompareKeys(const void *key1, const void *key2)
+{
+    uint64_t K1 = *(const uint64_t *)key1, K2 = *(const uint64_t *)key2;
+    return K1 > K2 ? 1 : (K1 < K2 ? -1 : 0);
+}
+
+/// @brief Compares two 16 bit symbols
+/// @param symbol1 The first symbol
+/// @param symbol2 The second symbol
+/// @return 1 if S1 > S2, -1 if S1 < S2, 0 if S1 == S2
+int CompareSymbols(const void *symbol1, const void *symbol2)
+{
+    return (int)*(const uint16_t *)symbol1 - (int)*(const uint16_t *)symbol2;
+}
+
+/// @brief Sorts count << 16 | symbol keys, listed in increasing order of symbol, by count in two stable
+/// passes of 10 bits, so equal counts stay in symbol order. Counts are below WIDE_BLOCKSIZE
+/// @param keys The keys, sorted in place
+/// @param scratch Room for n keys
+/// @param n Number of keys
+void RadixSortKeys(uint64_t *keys, uint64_t *scratch, unsigned int n)
+{
+    uint64_t *from = keys, *to = scratch;
+
+    for (int shift = 16; shift < 16 + 20; shift += 10)
+    {
+        unsigned int offsets[1 << 10] = {0}, total = 0;
+        for (unsigned int i = 0; i < n; i++)
+            offsets[(from[i] >> shift) & 1023]++;
+        for (int digit = 0; digit < 1 << 10; digit++)
+        {
+            unsigned int size = offsets[digit];
+            offsets[digit] = total;
+            total += size;
+        }
+        for (unsigned int i = 0; i < n; i++)
+            to[offsets[(from[i] >> shift) & 1023]++] = from[i];
+        uint64_t *swap = from;
+        from = to;
+        to = swap;
+    }
+}
+
+/// @brief Replaces sorted weights with their minimum redundancy code lengths in place (Moffat and
+/// Katajainen). The parents are made in the same array the weights are read from, so no tree is built
+/// and an alphabet of any size needs no memory beyond its weights
+/// @param a Weights in increasing order, replaced by the code lengths, longest first
+/// @param n Number of weights, at least 2
+void SetSortedCodeLengths(uint64_t *a, unsigned int n)
+{
+    unsigned int root = 0, leaf = 2, avail = 1, used = 0, depth = 0;
+    int parent = (int)n - 2, slot = (int)n - 1;
+
+    // first pass: each parent takes the slot of the next node, the nodes it joins point to it, and
+    // the two lowest nodes are at the front of either the leaves or the parents, leaves first on ties
+    a[0] += a[1];
+    for (unsigned int next = 1; next < n - 1; next++)
     {
-        // get code and shift so MSB is first bit in code
-        index = GetCodeFromCharacter(ht, inbyte);
-        hcode = ht->tree[index]->hcode;
+        if (leaf >= n || a[root] < a[leaf])
+        {
+            a[next] = a[root];
+            a[root++] = next;
+        }
+        else
+            a[next] = a[leaf++];
+        if (leaf >= n || (root < next && a[root] < a[leaf]))
+        {
+            a[next] += a[root];
+            a[root++] = next;
+        }
+        else
+            a[next] += a[leaf++];
+    }
 
-        // printf("Character %c with hcode: %d\n", ht->tree[index]->value, hcode);
+    // second pass: depth of every parent, from the root down
+    a[n - 2] = 0;
+    for (int i = (int)n - 3; i >= 0; i--)
+        a[i] = a[a[i]] + 1;
 
-        // for the length of the code
-        for (int i = 0; i < ht->tree[index]->codelength; i++)
+    // third pass: the nodes at each depth that are not parents are leaves
+    while (avail > 0)
+    {
+        while (parent >= 0 && a[parent] == depth)
+        {
+            used++;
+            parent--;
+        }
+        while (avail > used)
         {
-            // move LSB of hcode to MSB of outbyte
-            outbyte = (outbyte & 0x7F) | ((hcode & 1) << 7);
-            bitsinbyte++;
-            thisbytebits++;
+            a[slot--] = depth;
+            avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+/// @brief Brings code lengths set by SetSortedCodeLengths within maxlength. The lengths over the limit
+/// are cut to it, then codes are moved one level deeper, from the deepest level above the limit, until
+/// the code space is no longer oversubscribed. Much cheaper than package-merge on a large alphabet, and
+/// close to optimal when few codes are over the limit
+/// @param lengths Code lengths, longest first
+/// @param n Number of lengths, at most 1 << maxlength
+/// @param maxlength Longest code allowed, at most MAXCODELEN
+void LimitSortedCodeLengths(uint64_t *lengths, unsigned int n, unsigned char maxlength)
+{
+    unsigned int levels[MAXCODELEN + 1] = {0};
+    uint64_t kraft = 0;
 
-            if (bitsinbyte == 8)
+    if (n == 0 || lengths[0] <= maxlength)
+        return;
+    for (unsigned int i = 0; i < n; i++)
+        levels[lengths[i] > maxlength ? maxlength : lengths[i]]++;
+    for (int len = 1; len <= maxlength; len++)
+        kraft += (uint64_t)levels[len] << (maxlength - len);
+
+    // each round takes a code off the limit and splits a shorter one in two, one unit of space less
+    while (kraft > ((uint64_t)1 << maxlength))
+    {
+        levels[maxlength]--;
+        for (int len = maxlength - 1; len > 0; len--)
+        {
+            if (levels[len] != 0)
             {
-                counter++;
-                // printf("Wrote char #%d: %u with %d bits from char %c to file\n\n", counter, outbyte, thisbytebits, outbyte);
-                // write byte to file
-                fwrite(&outbyte, sizeof(unsigned char), 1, output);
-                bitsinbyte = 0;
-                outbyte = 0; // rst outbyte
+                levels[len]--;
+                levels[len + 1] += 2;
+                break;
             }
-            // shift hcode and outbyte one to the right
-            hcode >>= 1;
-            outbyte >>= 1;
         }
-        thisbytebits = 0;
+        kraft--;
     }
-    // printf("Bits in byte: %d\n", bitsinbyte);
 
-    // write the remaining bits
-    if (bitsinbyte != 0)
+    // the longest codes go back to the least frequent symbols
+    unsigned int i = 0;
+    for (int len = maxlength; len > 0; len--)
+    {
+        for (unsigned int k = 0; k < levels[len]; k++)
+            lengths[i++] = len;
+    }
+}
+
+/// @brief Hands out canonical codes to the present symbols, in order of length then symbol value
+/// @param hw The codec, with the code lengths of its present symbols set and present in increasing order
+/// @return 0 if successful, -1 if the lengths oversubscribe the code space
+int AssignWideCodes(HTWide *hw)
+{
+    unsigned int lengthcount[WIDE_MAXCODELEN + 1] = {0};
+    uint64_t nextcode[WIDE_MAXCODELEN + 1];
+    uint64_t code = 0, kraft = 0;
+
+    for (unsigned int i = 0; i < hw->npresent; i++)
     {
-        counter++;
-        outbyte <<= 1; // shift back since we shifted, but didn't add new bit to byte
-        // printf("Wrote final char #%d: %u with char %c to file\n\n", counter, outbyte, outbyte);
-        fwrite(&outbyte, sizeof(unsigned char), 1, output);
+        unsigned char len = hw->encoder[hw->present[i]].codelength;
+        lengthcount[len]++;
+        kraft += (uint64_t)1 << (WIDE_MAXCODELEN - len);
     }
-    // last char is always bitsinbyte, tells you # bits in final byte are valid
-    // printf("Wrote bitsinbyte: %u with char %c to file\n\n", bitsinbyte, bitsinbyte);
-    fwrite(&bitsinbyte, sizeof(unsigned char), 1, output);
+    if (kraft > ((uint64_t)1 << WIDE_MAXCODELEN))
+        return -1;
 
+    lengthcount[0] = 0;
+    for (int len = 1; len <= WIDE_MAXCODELEN; len++)
+    {
+        code = (code + lengthcount[len - 1]) << 1;
+        nextcode[len] = code;
+    }
+    for (unsigned int i = 0; i < hw->npresent; i++)
+    {
+        EncodeEntry *entry = &hw->encoder[hw->present[i]];
+        entry->hcode = ReverseBits((unsigned int)nextcode[entry->codelength]++, entry->codelength);
+        entry->present = true;
+    }
     return 0;
 }
 
-#pragma endregion Compression
+/// @brief Counts the symbols of a block into the sparse histogram, listing each symbol the first time
+/// it is seen so only those entries are visited and cleared afterwards
+/// @param hw The codec, with every count zero
+/// @param in The symbols of the block
+/// @param count Number of symbols
+/// @return 0 if successful, -1 if a symbol is outside the alphabet
+int CountWideSymbols(HTWide *hw, const uint16_t *in, size_t count)
+{
+    uint32_t *counts = hw->counts;
+    unsigned int npresent = 0;
+    int status = 0;
 
-#pragma region Decompression
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t symbol = in[i];
+        if (symbol >= hw->alphabet)
+        {
+            status = -1;
+            break;
+        }
+        if (counts[symbol]++ == 0)
+            hw->present[npresent++] = symbol;
+    }
+    hw->npresent = npresent;
+    return status;
+}
 
-HuffmanTree *ReadCompressedTreeFromFile(FILE *input)
+/// @brief Lists the symbols with a nonzero count in increasing order, by a pass over the histogram
+/// @param hw The codec, with the symbols of the block counted
+void PickWideSymbols(HTWide *hw)
 {
-    HuffmanTree *ht = InitHTLight();
-    if (ht == NULL)
-        return NULL;
+    unsigned int n = 0;
 
-    fread(&ht->count, sizeof(unsigned int), 1, input);
-    for (int i = 0; i < ht->count; i++)
+    for (unsigned int symbol = 0; symbol < hw->alphabet; symbol++)
     {
-        CompressedNode cnode;
-        HuffmanNode *hnode = (HuffmanNode *)calloc(1, sizeof(HuffmanNode));
-        fread(&cnode, sizeof(CompressedNode), 1, input);
-        hnode->value = cnode.value;
-        hnode->codelength = cnode.codelength;
-        hnode->hcode = cnode.hcode;
-        ht->tree[i] = hnode;
+        if (hw->counts[symbol] != 0)
+            hw->present[n++] = (uint16_t)symbol;
     }
-    return ht;
 }
 
-/// @brief Reads the Huffman tree from a file and restores it's structure, except for the pointers between nodes
-/// @param input
-/// @return
-HuffmanTree *ReadTreeFromFile(FILE *input)
+/// @brief Sets the length limited canonical codes of the symbols counted by CountWideSymbols, and
+/// leaves present in increasing order
+/// @param hw The codec, with at least 2 symbols present
+/// @param codebits Set to the bits the codes of the block take
+void BuildWideCodes(HTWide *hw, uint64_t *codebits)
 {
-    // Write the huffman tree to the file so that it can be used on decode
-    HuffmanTree *ht = InitHT();
-    if (ht == NULL)
+    unsigned int n = hw->npresent;
+    bool dense = n >= hw->alphabet / 16;
+
+    // a few symbols are sorted as they are, many are picked out of the histogram in order and sorted
+    // by count alone. Either way equal counts go in symbol order, so the codes do not depend on the
+    // order the symbols were seen in
+    if (dense)
+        PickWideSymbols(hw);
+    for (unsigned int i = 0; i < n; i++)
+        hw->sorted[i] = (uint64_t)hw->counts[hw->present[i]] << 16 | hw->present[i];
+    if (dense)
+        RadixSortKeys(hw->sorted, hw->scratch, n);
+    else
+        qsort(hw->sorted, n, sizeof(uint64_t), CompareKeys);
+    for (unsigned int i = 0; i < n; i++)
     {
-        return NULL;
+        hw->present[i] = (uint16_t)hw->sorted[i];
+        hw->sorted[i] >>= 16;
     }
+    SetSortedCodeLengths(hw->sorted, n);
+    LimitSortedCodeLengths(hw->sorted, n, WIDE_MAXCODELEN);
 
-    fread(ht, sizeof(HuffmanTree), 1, input);
-
-    // for each node that was in the tree, add it
-    for (int i = 0; i < ht->count; i++)
+    *codebits = 0;
+    for (unsigned int i = 0; i < n; i++)
     {
-        HuffmanNode *hnode = (HuffmanNode *)calloc(1, sizeof(HuffmanNode));
-        fread(hnode, sizeof(HuffmanNode), 1, input);
-        ht->tree[i] = hnode;
+        hw->encoder[hw->present[i]].codelength = (unsigned char)hw->sorted[i];
+        *codebits += (uint64_t)hw->counts[hw->present[i]] * hw->sorted[i];
     }
-    // This does NOT restore the pointers for the connections between the nodes
-    // but that does not matter, cause you just loop through them to get values from keys
-    ht->root = ht->tree[ht->count - 1];
 
-    return ht;
+    if (dense)
+        PickWideSymbols(hw);
+    else
+        qsort(hw->present, n, sizeof(uint16_t), CompareSymbols);
+    AssignWideCodes(hw);
 }
 
-int ReadDataFromFile(HuffmanTree *ht, FILE *input, FILE *output)
+/// @brief Size of the code lengths header of the present symbols: their number and the gaps between
+/// them as varints, then WIDE_LENGTHBITS per length
+/// @param hw The codec, with present in increasing order
+/// @return size of the header in bytes
+size_t WideLengthsSize(const HTWide *hw)
+{
+    unsigned char varint[10];
+    size_t size = PutVarint(varint, hw->npresent);
+    unsigned int next = 0;
+
+    for (unsigned int i = 0; i < hw->npresent; i++)
+    {
+        size += PutVarint(varint, hw->present[i] - next);
+        next = hw->present[i] + 1;
+    }
+    return size + ((size_t)hw->npresent * WIDE_LENGTHBITS + 7) / 8;
+}
+
+/// @brief Compresses one block of 16 bit symbols into a self contained block: header, code lengths, then
+/// the codes. A block of one symbol is stored as that symbol, and a block the codes would not shrink as
+/// its little endian values
+/// @param hw The codec, with every count zero
+/// @param in The symbols of the block
+/// @param count Number of symbols, at most WIDE_BLOCKSIZE
+/// @param out Buffer for the block
+/// @param cap Size of out
+/// @return size of the block in bytes, or -1 if a symbol is outside the alphabet or the block does not fit
+long EncodeWideBlock(HTWide *hw, const uint16_t *in, size_t count, unsigned char *out, size_t cap)
 {
-    unsigned char inbyte = 0, bb = 0;
-    unsigned int hcode = 0, revhcode = 0;
-    int idx = 0, hlen = 0, hvalue = 0, bit = 0, bitc = 8;
-    unsigned long start, len, count = 0;
+    size_t pos = BLOCK_HEADERSIZE;
+    unsigned char type = BLOCK_HUFFMAN;
+    uint64_t codebits = 0;
+    long status = 0;
+
+    if (cap < BLOCK_HEADERSIZE)
+        return -1;
+    if (CountWideSymbols(hw, in, count) != 0)
+        status = -1;
+    else if (hw->npresent == 1)
+        type = BLOCK_RLE;
+    else
+    {
+        BuildWideCodes(hw, &codebits);
+        if (WideLengthsSize(hw) + (codebits + 7) / 8 >= 2 * count)
+            type = BLOCK_RAW;
+    }
 
-    start = ftell(input);
-    fseek(input, 0, SEEK_END);
-    len = ftell(input) - start - 1;
-    fseek(input, start, SEEK_SET);
+    // the counts are cleared for the next block whatever happens to this one
+    for (unsigned int i = 0; i < hw->npresent; i++)
+        hw->counts[hw->present[i]] = 0;
+    if (status != 0)
+        return -1;
 
-    for (count = 0; count < len; count++)
+    if (type == BLOCK_RLE || type == BLOCK_RAW)
     {
-        fread(&inbyte, sizeof(unsigned char), 1, input);
-        if (count == len - 1)
+        size_t n = type == BLOCK_RLE ? 1 : count;
+        if (cap - pos < 2 * n)
+            return -1;
+        for (size_t i = 0; i < n; i++, pos += 2)
         {
-            fread(&bb, sizeof(unsigned char), 1, input);
-            if (bb != 0)
-            {
-                inbyte >>= (8 - bb);
-                bitc = bb;
-            }
+            out[pos] = (unsigned char)in[i];
+            out[pos + 1] = (unsigned char)(in[i] >> 8);
         }
-        for (bit = 0; bit < bitc; bit++)
+    }
+    else
+    {
+        BitWriter writer = {0};
+        unsigned int next = 0, have = 0;
+        uint32_t bits = 0;
+
+        if (cap - pos < WideLengthsSize(hw))
+            return -1;
+        pos += PutVarint(out + pos, hw->npresent);
+        for (unsigned int i = 0; i < hw->npresent; i++)
         {
-            hcode = (inbyte & 0x01) | (hcode & 0xFFFFFFFE);
-            hlen++;
-            revhcode = 0;
-            revhcode = ReverseLowerNBits(hcode, hlen);
-            hvalue = GetCharacterFromCode(ht, revhcode, hlen);
-            if (hvalue == -1)
-            {
-                hcode <<= 1;
-                inbyte >>= 1;
-            }
-            else
-            {
-                fwrite(&hvalue, sizeof(unsigned char), 1, output);
-                hlen = 0;
-                hcode = 0;
-                inbyte >>= 1;
-            }
+            pos += PutVarint(out + pos, hw->present[i] - next);
+            next = hw->present[i] + 1;
         }
+        for (unsigned int i = 0; i < hw->npresent; i++)
+        {
+            bits |= (uint32_t)hw->encoder[hw->present[i]].codelength << have;
+            for (have += WIDE_LENGTHBITS; have >= 8; have -= 8, bits >>= 8)
+                out[pos++] = (unsigned char)bits;
+        }
+        if (have != 0)
+            out[pos++] = (unsigned char)bits;
+
+        writer.buffer = out + pos;
+        writer.cap = cap - pos;
+        for (size_t i = 0; i < count; i++)
+            PutBits(&writer, hw->encoder[in[i]].hcode, hw->encoder[in[i]].codelength);
+        FinishBits(&writer);
+        if (writer.overflow)
+            return -1;
+        pos += writer.len;
+    }
+
+    out[0] = type;
+    PutU32(out + 1, (uint32_t)count);
+    PutU32(out + 5, (uint32_t)(pos - BLOCK_HEADERSIZE));
+    return (long)pos;
+}
+
+/// @brief Decodes a number of 16 bit symbols from a memory bit reader. Every lookup yields a whole symbol
+/// @param table The decode tables
+/// @param reader The reader, positioned at the first code
+/// @param out Buffer for the decoded symbols
+/// @param count Number of symbols to decode
+/// @return 0 if successful, -1 on an invalid code or if the stream runs out
+int DecodeWideSymbols(const DecodeTable *table, BitReader *reader, uint16_t *out, size_t count)
+{
+    size_t produced = 0;
+
+    while (produced < count)
+    {
+        RefillBits(reader);
+        if (reader->count == 0)
+            return -1; // ran out of bits
+
+        // decode until the buffer can no longer be trusted to hold a whole code
+        do
+        {
+            DecodeEntry entry = LookupCode(table, reader->bits);
+            if (entry.length == 0 || entry.length > reader->count)
+                return -1;
+            reader->bits >>= entry.length;
+            reader->count -= entry.length;
+            out[produced++] = (uint16_t)entry.value;
+        } while (produced < count && reader->count >= table->maxlength);
     }
     return 0;
 }
 
-#pragma endregion Decompression
+/// @brief Decodes a block written by EncodeWideBlock
+/// @param hw The codec to rebuild the block's codes in
+/// @param block The block, header included
+/// @param size Size of the block
+/// @param out Buffer for the decoded symbols, large enough for the whole block
+/// @return 0 if successful, -1 if the block is malformed or holds a symbol outside the alphabet
+int DecodeWideBlock(HTWide *hw, const unsigned char *block, size_t size, uint16_t *out)
+{
+    BitReader reader = {0};
+    size_t count, pos = BLOCK_HEADERSIZE;
+    uint64_t npresent, gap;
+    unsigned int next = 0, have = 0;
+    uint32_t bits = 0;
+    int used;
 
-#pragma endregion Private Functions
+    if (size < BLOCK_HEADERSIZE || GetU32(block + 5) != size - BLOCK_HEADERSIZE)
+        return -1;
+    count = GetU32(block + 1);
+
+    if (block[0] == BLOCK_RAW || block[0] == BLOCK_RLE)
+    {
+        if (size - pos != (block[0] == BLOCK_RAW ? 2 * count : 2))
+            return -1;
+        for (size_t i = 0; i < count; i++)
+        {
+            const unsigned char *value = block + pos + (block[0] == BLOCK_RAW ? 2 * i : 0);
+            uint16_t symbol = (uint16_t)(value[0] | value[1] << 8);
+            if (symbol >= hw->alphabet)
+                return -1; // as in a coded block, every symbol must be in the alphabet
+            out[i] = symbol;
+        }
+        return 0;
+    }
+    if (block[0] != BLOCK_HUFFMAN)
+        return -1;
+
+    if ((used = GetVarint(block + pos, size - pos, &npresent)) < 0 || npresent < 2 || npresent > hw->alphabet)
+        return -1;
+    pos += used;
+    hw->npresent = (unsigned int)npresent;
+    for (unsigned int i = 0; i < hw->npresent; i++)
+    {
+        if ((used = GetVarint(block + pos, size - pos, &gap)) < 0 || gap >= hw->alphabet - next)
+            return -1;
+        pos += used;
+        hw->present[i] = (uint16_t)(next + gap);
+        next += (unsigned int)gap + 1;
+    }
+    if (size - pos < ((size_t)hw->npresent * WIDE_LENGTHBITS + 7) / 8)
+        return -1;
+    for (unsigned int i = 0; i < hw->npresent; i++)
+    {
+        for (; have < WIDE_LENGTHBITS; have += 8)
+            bits |= (uint32_t)block[pos++] << have;
+        unsigned char len = bits & ((1U << WIDE_LENGTHBITS) - 1);
+        bits >>= WIDE_LENGTHBITS;
+        have -= WIDE_LENGTHBITS;
+        if (len == 0 || len > WIDE_MAXCODELEN)
+            return -1;
+        hw->encoder[hw->present[i]].codelength = len;
+    }
+    if (AssignWideCodes(hw) != 0 || FillDecodeTable(&hw->decoder, hw->present, hw->npresent, hw->encoder) != 0)
+        return -1;
+
+    reader.buffer = block + pos;
+    reader.len = size - pos;
+    return DecodeWideSymbols(&hw->decoder, &reader, out, count);
+}
+
+/// @brief Checks the header of a wide container
+/// @param in The container
+/// @param len Size of the container
+/// @param alphabet Set to the alphabet the container was coded with
+/// @param count Set to the number of symbols it holds
+/// @return 0 if successful, -1 if the header is malformed
+int ParseWideHeader(const unsigned char *in, size_t len, unsigned int *alphabet, uint64_t *count)
+{
+    if (in == NULL || len < WIDE_HEADERSIZE || memcmp(in, WIDE_MAGIC, 3) != 0 || in[3] != WIDE_VERSION)
+        return -1;
+    *alphabet = GetU32(in + 4);
+    *count = GetU64(in + 8);
+    if (*alphabet == 0 || *alphabet > HT_MAXALPHABET)
+        return -1;
+    return 0;
+}
+
+/// @brief Makes a codec for symbols below alphabet. Its tables are sized for the alphabet once, so it
+/// should be kept and reused. A codec is used by one thread at a time
+/// @param alphabet Number of symbols, from 1 to HT_MAXALPHABET
+/// @return the codec, or NULL on failure
+HTWide *InitHTWide(unsigned int alphabet)
+{
+    HTWide *hw;
+
+    if (alphabet == 0 || alphabet > HT_MAXALPHABET)
+        return NULL;
+    hw = (HTWide *)calloc(1, sizeof(HTWide));
+    if (hw == NULL)
+        return NULL;
+    hw->alphabet = alphabet;
+    hw->counts = (uint32_t *)calloc(alphabet, sizeof(uint32_t));
+    hw->present = (uint16_t *)malloc(alphabet * sizeof(uint16_t));
+    hw->sorted = (uint64_t *)malloc(alphabet * sizeof(uint64_t));
+    hw->scratch = (uint64_t *)malloc(alphabet * sizeof(uint64_t));
+    hw->encoder = (EncodeEntry *)calloc(alphabet, sizeof(EncodeEntry));
+    if (hw->counts == NULL || hw->present == NULL || hw->sorted == NULL || hw->scratch == NULL ||
+        hw->encoder == NULL)
+    {
+        FreeHTWide(hw);
+        return NULL;
+    }
+    return hw;
+}
+
+/// @brief Frees a codec
+/// @param hw The codec, may be NULL
+void FreeHTWide(HTWide *hw)
+{
+    if (hw == NULL)
+        return;
+    free(hw->counts);
+    free(hw->present);
+    free(hw->sorted);
+    free(hw->scratch);
+    free(hw->encoder);
+    free(hw->decoder.sub);
+    free(hw);
+}
+
+/// @brief Worst case size of the container CompressHTWide makes of count symbols
+/// @param count Number of symbols to compress
+/// @return the size to give the output buffer
+size_t GetHTWideBound(size_t count)
+{
+    size_t nblocks = (count + WIDE_BLOCKSIZE - 1) / WIDE_BLOCKSIZE;
+    return WIDE_HEADERSIZE + nblocks * BLOCK_HEADERSIZE + 2 * count;
+}
+
+/// @brief Number of symbols a wide container decompresses to, so the output of DecompressHTWide can be
+/// sized first
+/// @param in The container
+/// @param len Size of the container
+/// @return the number of symbols, or -1 if the container is malformed
+long GetHTWideCount(const void *in, size_t len)
+{
+    unsigned int alphabet;
+    uint64_t count;
+
+    if (ParseWideHeader((const unsigned char *)in, len, &alphabet, &count) != 0 || count > LONG_MAX)
+        return -1;
+    return (long)count;
+}
+
+/// @brief Compresses 16 bit symbols, each block of WIDE_BLOCKSIZE symbols with its own length limited
+/// canonical code over the symbols it holds. The container is a header of magic, version, alphabet and
+/// symbol count, then the blocks
+/// @param hw The codec, made for an alphabet holding every symbol
+/// @param in The symbols
+/// @param count Number of symbols
+/// @param out Buffer for the container, GetHTWideBound(count) bytes always fit it
+/// @param cap Size of out
+/// @return size of the container, or -1 if a symbol is outside the alphabet or it does not fit
+long CompressHTWide(HTWide *hw, const uint16_t *in, size_t count, void *out, size_t cap)
+{
+    unsigned char *bytes = (unsigned char *)out;
+    size_t pos = WIDE_HEADERSIZE;
+
+    if (hw == NULL || (in == NULL && count != 0) || bytes == NULL || cap < WIDE_HEADERSIZE)
+        return -1;
+    memcpy(bytes, WIDE_MAGIC, 3);
+    bytes[3] = WIDE_VERSION;
+    PutU32(bytes + 4, hw->alphabet);
+    PutU64(bytes + 8, count);
+
+    for (size_t done = 0; done < count; done += WIDE_BLOCKSIZE)
+    {
+        size_t n = count - done < WIDE_BLOCKSIZE ? count - done : WIDE_BLOCKSIZE;
+        long size = EncodeWideBlock(hw, in + done, n, bytes + pos, cap - pos);
+        if (size < 0)
+            return -1;
+        pos += size;
+    }
+    return (long)pos;
+}
+
+/// @brief Decompresses a container made by CompressHTWide
+/// @param hw A codec whose alphabet is at least the one the container was made with
+/// @param in The container
+/// @param len Size of the container
+/// @param out Buffer for the symbols
+/// @param cap Number of symbols out holds
+/// @return number of symbols, or -1 if the container is malformed, has a larger alphabet or does not fit
+long DecompressHTWide(HTWide *hw, const void *in, size_t len, uint16_t *out, size_t cap)
+{
+    const unsigned char *bytes = (const unsigned char *)in;
+    size_t pos = WIDE_HEADERSIZE, produced = 0;
+    unsigned int alphabet;
+    uint64_t count;
+
+    if (hw == NULL || ParseWideHeader(bytes, len, &alphabet, &count) != 0 || alphabet > hw->alphabet ||
+        count > cap || (out == NULL && count != 0))
+        return -1;
+    while (produced < count)
+    {
+        if (len - pos < BLOCK_HEADERSIZE)
+            return -1;
+        size_t n = GetU32(bytes + pos + 1), size = BLOCK_HEADERSIZE + (size_t)GetU32(bytes + pos + 5);
+        if (n == 0 || n > WIDE_BLOCKSIZE || n > count - produced || size > len - pos ||
+            DecodeWideBlock(hw, bytes + pos, size, out + produced) != 0)
+            return -1;
+        pos += size;
+        produced += n;
+    }
+    return (long)produced;
+}
+
+#pragma endregion Wide
+
+#pragma region Files
+
+/// @brief Number of threads the drivers use
+/// @return the number of online processors, at least 1
+int GetThreadCount()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (n > POOL_MAXTHREADS ? POOL_MAXTHREADS : (int)n);
+}
+
+/// @brief Maps a whole file read only and hints the kernel that it will be read front to back
+/// @param fd The open file
+/// @param len Set to the size of the file
+/// @return the mapping, NULL for an empty file, or MAP_FAILED on failure
+const unsigned char *MapInput(int fd, size_t *len)
+{
+    struct stat st;
+    void *data;
+
+    if (fstat(fd, &st) != 0)
+        return (const unsigned char *)MAP_FAILED;
+    *len = (size_t)st.st_size;
+    if (*len == 0)
+        return NULL;
+    data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+        madvise(data, *len, MADV_SEQUENTIAL);
+    return (const unsigned char *)data;
+}
+
+/// @brief Makes the name of a driver's output file
+/// @param path The input file's name
+/// @param strip Suffix to drop from the input's name if it ends in it, or NULL
+/// @param suffix Suffix to add
+/// @return the name, to be freed by the caller, or NULL if out of memory
+char *MakeOutputPath(const char *path, const char *strip, const char *suffix)
+{
+    size_t len = strlen(path);
+    char *name;
+
+    if (strip != NULL && len > strlen(strip) && strcmp(path + len - strlen(strip), strip) == 0)
+        len -= strlen(strip);
+    name = (char *)malloc(len + strlen(suffix) + 1);
+    if (name == NULL)
+        return NULL;
+    memcpy(name, path, len);
+    strcpy(name + len, suffix);
+    return name;
+}
+
+/// @brief Decodes every block of a mapped container straight into a mapping of the output file
+/// @param data The container
+/// @param len Size of the container
+/// @param outpath The file to decompress into, created or truncated
+/// @param nthreads Number of decompression threads
+/// @return 0 if successful, 1 if the container has no valid index, -1 on failure
+int DecompressMapping(const unsigned char *data, size_t len, const char *outpath, int nthreads)
+{
+    BlockIndexEntry *index;
+    BlockJob *jobs;
+    BlockPool pool;
+    unsigned char *out = NULL;
+    uint64_t expected;
+    uint32_t count = 0;
+    size_t blocksize, rawsize;
+    int fd, status = 0;
+    bool measure = statsHook != NULL;
+    uint64_t start = measure ? GetTimeNs() : 0;
+
+    if (len < FORMAT_HEADERSIZE || ParseFormatHeader(data, &blocksize, &expected) != 0)
+        return -1;
+    index = FindBlockIndex(data, len, blocksize, expected, &count);
+    if (index == NULL)
+        return 1;
+    rawsize = count == 0 ? 0 : (size_t)(index[count - 1].rawoffset + index[count - 1].rawsize);
+
+    // the output is sized up front so every worker can decode into its block's place in it
+    fd = open(outpath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)rawsize) != 0)
+        status = -1;
+    if (status == 0 && rawsize != 0)
+    {
+        out = (unsigned char *)mmap(NULL, rawsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (out == (unsigned char *)MAP_FAILED)
+        {
+            out = NULL;
+            status = -1;
+        }
+    }
+    jobs = (BlockJob *)calloc((size_t)count + 1, sizeof(BlockJob));
+    if (status == 0 && count != 0)
+    {
+        if (jobs == NULL || StartPool(&pool, nthreads, count, DecompressBlockJob) != 0)
+            status = -1;
+        else
+        {
+            for (uint32_t i = 0; i < count; i++)
+                jobs[i].measure = measure;
+            status = DecodeBlockSpan(&pool, jobs, data + index[0].offset, index, count, out);
+        }
+        if (jobs != NULL)
+            StopPool(&pool);
+    }
+    if (measure && status == 0)
+    {
+        BlockStats total = {0};
+        for (uint32_t i = 0; i < count; i++)
+            MergeStats(&total, &jobs[i].stats);
+        ReportStats(false, &total, len, rawsize, start);
+    }
+
+    if (out != NULL)
+        munmap(out, rawsize);
+    if (fd >= 0)
+        close(fd);
+    free(jobs);
+    free(index);
+    return status;
+}
+
+#pragma endregion Files
 
 #pragma region Public Functions
 
 /// @brief Does huffman tree based compression on an input file. The compressed file is output with the suffix .hf
-/// @param input THe file to compress.
+/// The input is mapped and its blocks are compressed in place on every processor
+/// @param path The file to compress.
 /// @return 0 upon success, failure on any other
-int DoHTCompression(FILE *input)
+int DoHTCompression(const char *path)
 {
+    const unsigned char *data;
+    char *outpath;
+    FILE *output;
+    size_t len = 0;
+    int fd, status;
 
-    return 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Cannot open %s!\n", path);
+        return -1;
+    }
+    data = MapInput(fd, &len);
+    outpath = MakeOutputPath(path, NULL, ".hf");
+    output = outpath == NULL ? NULL : fopen(outpath, "wb");
+    if (data == (const unsigned char *)MAP_FAILED || output == NULL)
+    {
+        printf("Cannot compress %s!\n", path);
+        status = -1;
+    }
+    else
+    {
+        setvbuf(output, NULL, _IOFBF, DRIVER_IOBUFSIZE);
+        status = WriteBlocks(NULL, data, len, output, HT_BLOCKSIZE, GetThreadCount(), HT_INTERLEAVE);
+    }
+
+    if (output != NULL && fclose(output) != 0)
+        status = -1;
+    if (data != NULL && data != (const unsigned char *)MAP_FAILED)
+        munmap((void *)data, len);
+    close(fd);
+    free(outpath);
+    return status;
 }
 
 /// @brief Does huffman tree based decompression on an input file. THe decompressed file is output with the suffix .u
-/// @param input The file to decompress
+/// in place of .hf. The input and the output are mapped and the blocks are decoded on every processor
+/// @param path The file to decompress
 /// @return 0 upon success, failure on any other
-int DoHTDecompression(FILE *input)
+int DoHTDecompression(const char *path)
 {
+    const unsigned char *data;
+    char *outpath;
+    size_t len = 0;
+    int fd, status = -1;
 
-    return 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Cannot open %s!\n", path);
+        return -1;
+    }
+    data = MapInput(fd, &len);
+    outpath = MakeOutputPath(path, ".hf", ".u");
+    if (data != (const unsigned char *)MAP_FAILED && data != NULL && outpath != NULL)
+        status = DecompressMapping(data, len, outpath, GetThreadCount());
+    if (status == 1)
+    { // no index, decode the blocks in order instead
+        FILE *input = fopen(path, "rb"), *output = fopen(outpath, "wb");
+        status = input == NULL || output == NULL ? -1 : ReadBlocksFromFile(input, output, 1);
+        if (input != NULL)
+            fclose(input);
+        if (output != NULL && fclose(output) != 0)
+            status = -1;
+    }
+    if (status != 0)
+        printf("Cannot decompress %s!\n", path);
+
+    if (data != NULL && data != (const unsigned char *)MAP_FAILED)
+        munmap((void *)data, len);
+    close(fd);
+    free(outpath);
+    return status;
+}
+
+/// @brief Sets the function handed the stats of every block container compression and decompression:
+/// the file, buffer and stream calls and the drivers. Without a hook no clock is read and no stats are
+/// gathered. Set it before any coding starts, not while other threads are coding
+/// @param hook The function, NULL to stop gathering stats
+/// @param user Passed to every call of hook
+void SetHTStatsHook(HTStatsHook hook, void *user)
+{
+    statsUser = user;
+    statsHook = hook;
 }
 
 #pragma endregion Public Functions
@@ -1,36 +1,99 @@
 #ifndef HUFFTREE_H
 #define HUFFTREE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HT_MAXCODELEN 15 // default code length limit for BuildHTFromFrequencies
+#define HT_NONE 0xFFFF   // node index meaning "no node"
+#define HT_BYTEVALUES 256 // symbols of the byte codecs, one per byte value
+#define HT_MAXCOUNTBITS 56 // counts are scaled to total at most 2^56, so parent sums and package-merge weights fit 64 bits
+
+#define HT_BLOCKSIZE (1 << 20)     // default block size of WriteBlocksToFile
+#define HT_MINBLOCKSIZE (1 << 10)
+#define HT_MAXBLOCKSIZE (1 << 26)
+#define HT_UNKNOWNSIZE UINT64_MAX   // original size in the header of a container whose writer could not know it
+
+// flags of WriteBlocksToFile
+#define HT_INTERLEAVE 0x1 // code each block as 4 streams decoded in step
+#define HT_CHECKSUM 0x2   // store a CRC-32C of each block's data, verified when it is decoded
+
+// modes and results of FeedHTStream
+#define HT_RUN 0
+#define HT_FLUSH 1
+#define HT_FINISH 2
+#define HT_STREAMEND 1
+
+// sizes for dictionary mode
+#define HT_DICTSAVESIZE (8 + 1 + 256) // saved dictionary
+#define HT_DICTBOUND(len) ((len) + 11) // compressed message of len bytes
+
+#define HT_MAXALPHABET 65536 // largest alphabet of a wide codec
+
 typedef struct HuffmanNode HuffmanNode;
 typedef struct HuffmanTree HuffmanTree;
+typedef struct HTStream HTStream; // incremental codec context, see FeedHTStream
+typedef struct HTDictionary HTDictionary; // shared code table for small messages
+typedef struct HTWide HTWide; // codec of 16 bit symbols, see CompressHTWide
+struct DecodeTable;
+
+/// @brief Numbers of one block container compression or decompression, handed to the stats hook when the
+/// call ends. Phase times are summed over the worker threads, so with several threads they can add up to
+/// more than totalns
+typedef struct HTStats
+{
+    bool compress;            // true for a compression, false for a decompression
+    uint64_t bytesin, bytesout;
+    uint64_t blocks;
+    uint64_t tables;          // code tables built, one per block
+    uint64_t histogramns;     // counting the symbols of the blocks, compression only
+    uint64_t buildns;         // building the codes, or the decode tables when decompressing
+    uint64_t headerns;        // packing or unpacking the code lengths
+    uint64_t codens;          // encoding or decoding the symbols
+    uint64_t checksumns;      // computing or verifying the blocks' checksums
+    uint64_t totalns;         // wall time of the call
+    double entropy;           // order 0 entropy of the blocks in bits per symbol, compression only
+    double bitspersymbol;     // bits of the codes alone, without headers, per symbol
+    unsigned int maxcodelength;
+    double avgcodelength;     // mean code length over the symbols present in the blocks' tables
+} HTStats;
+
+/// @brief Receives the stats of every finished call. Runs on the calling thread
+typedef void (*HTStatsHook)(const HTStats *stats, void *user);
 
 typedef struct HuffmanNode
 {
     unsigned char value;    // the character value of
-    unsigned int frequency; // Freq of the byte within the file
+    uint64_t frequency;     // Freq of the byte within the file
     unsigned int hcode;     // the code of the node represented in the huffman tree
     unsigned char codelength;
-    HuffmanNode *left;  // NULL if dne
-    HuffmanNode *right; // NULL if dne
+    unsigned short left;  // index of the left child in HuffmanTree::tree, HT_NONE if dne
+    unsigned short right; // index of the right child in HuffmanTree::tree, HT_NONE if dne
 } HuffmanNode;
 
 typedef struct HuffmanTree
 {
-    unsigned int bytecount; // total # of bytes in read file
+    uint64_t bytecount;     // total # of bytes in read file
     unsigned int count;     // total number of nodes within the tree
-    unsigned int maxfreq;   // Largest frequency of a byte present within the file
-    HuffmanNode *tree[512]; // Huffman tree can be statically declared
-    HuffmanNode *root;
+    uint64_t maxfreq;       // Largest frequency of a byte present within the file
+    HuffmanNode tree[512];  // node arena: symbol nodes first, then parents in order of creation
+    unsigned short root;    // index of the root node, HT_NONE if the tree is empty
+    struct DecodeTable *decoder; // decode lookup tables, built on first use (NULL until then)
 } HuffmanTree;
 
 // funcs
-int DoHTCompression(FILE *fp);
-int DoHTDecompression(FILE *fp);
+int DoHTCompression(const char *path);
+int DoHTDecompression(const char *path);
 
 HuffmanTree *InitHT();
+void ResetHT(HuffmanTree *ht);
 int FreeHT(HuffmanTree *ht);
 int InitializeLeafNodes(FILE *inputFile, HuffmanTree *ht);
-int BuildHTFromFrequencies(HuffmanTree *ht);
+int InitializeLeafNodesFromMemory(const void *data, size_t len, HuffmanTree *ht, int nthreads);
+int InitializeLeafNodesFromCounts(const uint64_t *counts, HuffmanTree *ht);
+int BuildHTFromFrequencies(HuffmanTree *ht, unsigned char maxlength);
 int GetCodeFromCharacter(HuffmanTree *ht, unsigned char value);
 int GetCharacterFromCode(HuffmanTree *ht, unsigned int code, unsigned char len);
 int WriteTreeToFile(HuffmanTree *ht, FILE *output);
@@ -45,4 +108,42 @@ void PrintTreeInformation(HuffmanTree *ht, const char *opening);
 int WriteCompressedTreeToFile(HuffmanTree *ht, FILE *output);
 HuffmanTree *ReadCompressedTreeFromFile(FILE *input);
 
+// block container, each block coded with its own table
+int WriteBlocksToFile(FILE *input, FILE *output, size_t blocksize, int nthreads, unsigned int flags);
+int ReadBlocksFromFile(FILE *input, FILE *output, int nthreads);
+long ReadRangeFromFile(FILE *input, uint64_t offset, size_t length, unsigned char *out);
+
+// block container in memory, without heap allocation or stdio
+size_t GetCompressBound(size_t len);
+long WriteBlocksToBuffer(const void *input, size_t len, void *output, size_t cap, unsigned int flags);
+long ReadBlocksFromBuffer(const void *input, size_t len, void *output, size_t cap);
+long GetDecompressedSize(const void *input, size_t len);
+
+// incremental block container coding
+HTStream *InitHTStream(bool compress, unsigned int flags);
+void ResetHTStream(HTStream *hs);
+void FreeHTStream(HTStream *hs);
+int FeedHTStream(HTStream *hs, const void *in, size_t inlen, size_t *consumed, void *out, size_t outcap, size_t *produced,
+                 int mode);
+
+// dictionary mode, a table trained once and named by id in every message
+HTDictionary *TrainHTDictionary(const void *samples, size_t len, uint32_t id);
+long SaveHTDictionary(const HTDictionary *dict, void *out, size_t cap);
+HTDictionary *LoadHTDictionary(const void *in, size_t len);
+void FreeHTDictionary(HTDictionary *dict);
+long GetHTDictionaryID(const void *in, size_t len);
+long CompressWithHTDictionary(const HTDictionary *dict, const void *in, size_t len, void *out, size_t cap);
+long DecompressWithHTDictionary(const HTDictionary *dict, const void *in, size_t len, void *out, size_t cap);
+
+// 16 bit alphabet, for data made of 16 bit values such as UTF-16 text or int16 samples
+HTWide *InitHTWide(unsigned int alphabet);
+void FreeHTWide(HTWide *hw);
+size_t GetHTWideBound(size_t count);
+long GetHTWideCount(const void *in, size_t len);
+long CompressHTWide(HTWide *hw, const uint16_t *in, size_t count, void *out, size_t cap);
+long DecompressHTWide(HTWide *hw, const void *in, size_t len, uint16_t *out, size_t cap);
+
+// instrumentation
+void SetHTStatsHook(HTStatsHook hook, void *user);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "ht.h"
+
+#define DEFAULT_SIZE 16        // MB of each corpus
+#define DEFAULT_ITERATIONS 20000
+#define ROUNDS 3               // encode and decode runs per corpus, the fastest is kept
+#define WORDS 64               // vocabulary of the text corpus
+#define FIBSYMBOLS 40          // symbols of the fibonacci corpus, the deepest tree 32 bit counts allow
+
+/// @brief Draws symbols with fixed weights by searching a cumulative table
+typedef struct
+{
+    uint64_t cdf[HT_BYTEVALUES];
+    int count;
+} Sampler;
+
+/// @brief One synthetic input the codec is measured on
+typedef struct
+{
+    const char *name;
+    void (*make)(unsigned char *data, size_t len, uint64_t *state);
+} Corpus;
+
+/// @brief RSS at the start of a measured phase
+typedef struct
+{
+    long before;             // KB resident when the phase began
+    bool peak;               // the kernel's high water mark was reset to it, so the phase's peak can be read
+} Phase;
+
+/// @brief Results for one corpus
+typedef struct
+{
+    size_t compressed;
+    double encode, decode;   // MB/s of the block codec
+    double fileencode, filedecode; // MB/s of WriteDataToFile and ReadDataFromFile
+    double buildmean, buildmin; // ns per BuildHTFromFrequencies
+    long rss;                // KB resident with the corpus made
+    long grown[4];           // KB the RSS rose above that while encoding, decoding, file encoding and file decoding
+} Result;
+
+/// @brief Current time of the monotonic clock
+/// @return time in nanoseconds
+double NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/// @brief Reads a size from /proc/self/status
+/// @param field The field with its colon, "VmRSS:" or "VmHWM:"
+/// @return size in KB, 0 if it cannot be read
+long ReadStatusKB(const char *field)
+{
+    char line[128];
+    long kb = 0;
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, field, strlen(field)) == 0)
+        {
+            kb = atol(line + strlen(field));
+            break;
+        }
+    }
+    fclose(status);
+    return kb;
+}
+
+/// @brief Starts measuring the memory of a phase. ru_maxrss only ever grows, so instead the kernel's high
+/// water mark is reset to the current RSS (linux 4.0 and later), which leaves the phase's own peak in VmHWM.
+/// Memory earlier phases freed is handed back first, or the phase would reuse it without being charged
+/// @param phase Gets the starting RSS
+void BeginPhase(Phase *phase)
+{
+    malloc_trim(0);
+    FILE *refs = fopen("/proc/self/clear_refs", "w");
+    phase->peak = refs != NULL && fputs("5", refs) >= 0;
+    if (refs != NULL && fclose(refs) != 0)
+        phase->peak = false;
+    phase->before = ReadStatusKB("VmRSS:");
+}
+
+/// @brief Ends measuring the memory of a phase
+/// @param phase The phase, begun by BeginPhase
+/// @return KB the RSS peaked above its start, or grew by if the peak could not be reset
+long EndPhase(const Phase *phase)
+{
+    long after = ReadStatusKB(phase->peak ? "VmHWM:" : "VmRSS:");
+    return after > phase->before ? after - phase->before : 0;
+}
+
+/// @brief Next value of a xorshift64* generator, so every run makes the same corpus
+/// @param state Generator state, never 0
+/// @return 64 random bits
+uint64_t NextRandom(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/// @brief Sets up a sampler
+/// @param sampler The sampler
+/// @param weights Weight of each symbol
+/// @param count Number of symbols, at most HT_BYTEVALUES
+void InitSampler(Sampler *sampler, const uint64_t *weights, int count)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += weights[i];
+        sampler->cdf[i] = total;
+    }
+    sampler->count = count;
+}
+
+/// @brief Draws a symbol
+/// @param sampler The sampler
+/// @param state Generator state
+/// @return the symbol, 0 to count - 1
+int Sample(const Sampler *sampler, uint64_t *state)
+{
+    uint64_t r = NextRandom(state) % sampler->cdf[sampler->count - 1];
+    int low = 0, high = sampler->count - 1;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (sampler->cdf[mid] > r)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+
+/// @brief Every byte value equally likely, which no code can shrink
+void MakeUniform(unsigned char *data, size_t len, uint64_t *state)
+{
+    for (size_t i = 0; i < len; i++)
+        data[i] = (unsigned char)(NextRandom(state) >> 56);
+}
+
+/// @brief Byte values with zipf weights, 1 / (rank + 1)
+void MakeZipf(unsigned char *data, size_t len, uint64_t *state)
+{
+    uint64_t weights[HT_BYTEVALUES];
+    Sampler sampler;
+    for (int i = 0; i < HT_BYTEVALUES; i++)
+        weights[i] = 1000000 / (i + 1);
+    InitSampler(&sampler, weights, HT_BYTEVALUES);
+    for (size_t i = 0; i < len; i++)
+        data[i] = (unsigned char)Sample(&sampler, state);
+}
+
+/// @brief Lines of words drawn with zipf weights from a small made up vocabulary
+void MakeText(unsigned char *data, size_t len, uint64_t *state)
+{
+    char words[WORDS][12];
+    uint64_t weights[WORDS];
+    Sampler sampler;
+
+    for (int w = 0; w < WORDS; w++)
+    {
+        int wordlen = 2 + (int)(NextRandom(state) % 8);
+        for (int c = 0; c < wordlen; c++)
+            words[w][c] = "etaoinshrdlucmfwypvbgkjqxz"[NextRandom(state) % (c == 0 ? 26 : 12)];
+        words[w][wordlen] = '\0';
+        weights[w] = 100000 / (w + 1);
+    }
+    InitSampler(&sampler, weights, WORDS);
+
+    size_t pos = 0;
+    for (int n = 1; pos < len; n++)
+    {
+        const char *word = words[Sample(&sampler, state)];
+        for (int c = 0; word[c] != '\0' && pos < len; c++)
+            data[pos++] = (unsigned char)word[c];
+        if (pos < len)
+            data[pos++] = n % 12 == 0 ? '\n' : ' ';
+    }
+}
+
+/// @brief A single repeated byte
+void MakeSingle(unsigned char *data, size_t len, uint64_t *state)
+{
+    (void)state;
+    memset(data, 'a', len);
+}
+
+/// @brief 16 byte records as a program might log them: a counter, a timestamp, a small type and a value
+void MakeBinary(unsigned char *data, size_t len, uint64_t *state)
+{
+    uint32_t id = 0, time = 1700000000;
+    for (size_t pos = 0; pos < len; pos += 16, id++)
+    {
+        unsigned char record[16];
+        uint32_t value = (uint32_t)(NextRandom(state) % 1000);
+        time += (uint32_t)(NextRandom(state) % 4);
+        memcpy(record, &id, 4);
+        memcpy(record + 4, &time, 4);
+        record[8] = (unsigned char)(NextRandom(state) % 8);
+        record[9] = 0;
+        record[10] = 0;
+        record[11] = 0;
+        memcpy(record + 12, &value, 4);
+        memcpy(data + pos, record, len - pos < 16 ? len - pos : 16);
+    }
+}
+
+/// @brief Byte values with fibonacci weights, whose tree is as deep as it can be and needs length limiting
+void MakeFibonacci(unsigned char *data, size_t len, uint64_t *state)
+{
+    uint64_t weights[FIBSYMBOLS], a = 1, b = 1;
+    Sampler sampler;
+    for (int i = 0; i < FIBSYMBOLS; i++)
+    {
+        weights[i] = a;
+        uint64_t next = a + b;
+        a = b;
+        b = next;
+    }
+    InitSampler(&sampler, weights, FIBSYMBOLS);
+    for (size_t i = 0; i < len; i++)
+        data[i] = (unsigned char)Sample(&sampler, state);
+}
+
+/// @brief Times BuildHTFromFrequencies on the histogram of a corpus, reusing one tree as a compressor
+/// building a table per block would
+/// @param ht The tree
+/// @param data The corpus
+/// @param len Size of the corpus
+/// @param iterations Number of builds
+/// @param result Gets the mean and fastest build
+/// @return 0 if successful, -1 if a build failed
+int TimeBuild(HuffmanTree *ht, const unsigned char *data, size_t len, int iterations, Result *result)
+{
+    uint64_t counts[HT_BYTEVALUES] = {0};
+    double total = 0, best = INFINITY;
+
+    for (size_t i = 0; i < len; i++)
+        counts[data[i]]++;
+    for (int i = 0; i < iterations; i++)
+    {
+        InitializeLeafNodesFromCounts(counts, ht);
+        double start = NowNs();
+        int status = BuildHTFromFrequencies(ht, HT_MAXCODELEN);
+        double elapsed = NowNs() - start;
+        if (status != 0)
+            return -1;
+        total += elapsed;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    result->buildmean = total / iterations;
+    result->buildmin = best;
+    return 0;
+}
+
+/// @brief Measures the in memory block codec on a corpus
+/// @param data The corpus
+/// @param len Size of the corpus
+/// @param flags HT_ flags to compress with
+/// @param result Gets the compressed size, throughput and memory of encoding and decoding
+/// @return 0 if successful, -1 if the codec failed or did not reproduce the corpus
+int TimeCodec(const unsigned char *data, size_t len, unsigned int flags, Result *result)
+{
+    size_t bound = GetCompressBound(len);
+    unsigned char *compressed, *decompressed;
+    double encode = INFINITY, decode = INFINITY;
+    long size = -1;
+    int status = 0;
+    Phase phase;
+
+    // the buffers are counted in the phase that first touches them
+    BeginPhase(&phase);
+    compressed = (unsigned char *)malloc(bound);
+    decompressed = (unsigned char *)malloc(len);
+    if (compressed == NULL || decompressed == NULL)
+        status = -1;
+    for (int round = 0; round < ROUNDS && status == 0; round++)
+    {
+        double start = NowNs();
+        size = WriteBlocksToBuffer(data, len, compressed, bound, flags);
+        double elapsed = NowNs() - start;
+        if (size < 0)
+            status = -1;
+        if (elapsed < encode)
+            encode = elapsed;
+    }
+    result->grown[0] = EndPhase(&phase);
+    BeginPhase(&phase);
+    for (int round = 0; round < ROUNDS && status == 0; round++)
+    {
+        double start = NowNs();
+        long got = ReadBlocksFromBuffer(compressed, size, decompressed, len);
+        double elapsed = NowNs() - start;
+        if (got != (long)len || memcmp(data, decompressed, len) != 0)
+            status = -1;
+        if (elapsed < decode)
+            decode = elapsed;
+    }
+    result->grown[1] = EndPhase(&phase);
+
+    result->compressed = size < 0 ? 0 : (size_t)size;
+    result->encode = len / (encode / 1e9) / 1e6;
+    result->decode = len / (decode / 1e9) / 1e6;
+    free(compressed);
+    free(decompressed);
+    return status;
+}
+
+/// @brief Measures the single tree file codec, WriteDataToFile and ReadDataFromFile, on a corpus. The
+/// files are temporary files, so the page cache and not the disk is what they are read from and written to
+/// @param ht The tree, rebuilt for the corpus
+/// @param data The corpus
+/// @param len Size of the corpus
+/// @param result Gets the throughput and memory of encoding and decoding
+/// @return 0 if successful, -1 if the codec failed or did not reproduce the corpus
+int TimeFile(HuffmanTree *ht, const unsigned char *data, size_t len, Result *result)
+{
+    FILE *input = tmpfile(), *compressed = NULL, *decompressed = NULL;
+    unsigned char *check = (unsigned char *)malloc(len);
+    double encode = INFINITY, decode = INFINITY;
+    int status = 0;
+    Phase phase;
+
+    ResetHT(ht);
+    if (input == NULL || check == NULL || fwrite(data, sizeof(unsigned char), len, input) != len ||
+        InitializeLeafNodesFromMemory(data, len, ht, 1) != 0 || BuildHTFromFrequencies(ht, HT_MAXCODELEN) != 0)
+        status = -1;
+
+    BeginPhase(&phase);
+    for (int round = 0; round < ROUNDS && status == 0; round++)
+    {
+        if (compressed != NULL)
+            fclose(compressed);
+        compressed = tmpfile();
+        rewind(input);
+        if (compressed == NULL || WriteCompressedTreeToFile(ht, compressed) != 0)
+        {
+            status = -1;
+            break;
+        }
+        double start = NowNs();
+        if (WriteDataToFile(ht, input, compressed) != 0 || fflush(compressed) != 0)
+            status = -1;
+        double elapsed = NowNs() - start;
+        if (elapsed < encode)
+            encode = elapsed;
+    }
+    result->grown[2] = EndPhase(&phase);
+
+    BeginPhase(&phase);
+    for (int round = 0; round < ROUNDS && status == 0; round++)
+    {
+        if (decompressed != NULL)
+            fclose(decompressed);
+        decompressed = tmpfile();
+        rewind(compressed);
+        HuffmanTree *read = ReadCompressedTreeFromFile(compressed);
+        if (decompressed == NULL || read == NULL)
+        {
+            FreeHT(read);
+            status = -1;
+            break;
+        }
+        double start = NowNs();
+        if (ReadDataFromFile(read, compressed, decompressed) != 0 || fflush(decompressed) != 0)
+            status = -1;
+        double elapsed = NowNs() - start;
+        FreeHT(read);
+        if (elapsed < decode)
+            decode = elapsed;
+    }
+    result->grown[3] = EndPhase(&phase);
+
+    if (status == 0)
+    {
+        rewind(decompressed);
+        if (fread(check, sizeof(unsigned char), len, decompressed) != len || fgetc(decompressed) != EOF ||
+            memcmp(check, data, len) != 0)
+            status = -1;
+    }
+    result->fileencode = len / (encode / 1e9) / 1e6;
+    result->filedecode = len / (decode / 1e9) / 1e6;
+    if (input != NULL)
+        fclose(input);
+    if (compressed != NULL)
+        fclose(compressed);
+    if (decompressed != NULL)
+        fclose(decompressed);
+    free(check);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    const Corpus corpora[] = {
+        {"uniform", MakeUniform}, {"zipf", MakeZipf}, {"text", MakeText},
+        {"single", MakeSingle}, {"binary", MakeBinary}, {"fibonacci", MakeFibonacci},
+    };
+    size_t size = (size_t)DEFAULT_SIZE << 20;
+    int iterations = DEFAULT_ITERATIONS;
+    unsigned int flags = 0;
+    bool csv = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            size = (size_t)atoi(argv[++i]) << 20;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0)
+            flags |= HT_INTERLEAVE;
+        else if (strcmp(argv[i], "-k") == 0)
+            flags |= HT_CHECKSUM;
+        else if (strcmp(argv[i], "-c") == 0)
+            csv = true;
+        else
+            iterations = 0;
+    }
+    if (iterations <= 0 || size == 0)
+    {
+        printf("usage: %s [-s corpus MB] [-n build iterations] [-i] [-k] [-c]\n", argv[0]);
+        printf("  -i  compress with HT_INTERLEAVE\n  -k  compress with HT_CHECKSUM\n  -c  print csv\n");
+        return 1;
+    }
+
+    unsigned char *data = (unsigned char *)malloc(size);
+    HuffmanTree *ht = InitHT();
+    if (data == NULL || ht == NULL)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+
+    if (csv)
+        printf("corpus,bytes,compressed,ratio,encode_mbs,decode_mbs,file_encode_mbs,file_decode_mbs,build_mean_ns,"
+               "build_min_ns,rss_corpus_kb,peak_encode_kb,peak_decode_kb,peak_file_encode_kb,peak_file_decode_kb\n");
+    else
+        printf("%-10s %8s %10s %10s %10s %10s %10s %10s %10s\n", "corpus", "ratio", "enc MB/s", "dec MB/s",
+               "file enc", "file dec", "build ns", "min ns", "peak +KB");
+
+    for (size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++)
+    {
+        Result result = {0};
+        uint64_t state = 0x9E3779B97F4A7C15ULL + c; // fixed seed per corpus
+
+        corpora[c].make(data, size, &state);
+        result.rss = ReadStatusKB("VmRSS:");
+        if (TimeBuild(ht, data, size, iterations, &result) != 0 || TimeCodec(data, size, flags, &result) != 0 ||
+            TimeFile(ht, data, size, &result) != 0)
+        {
+            printf("Codec failed on %s!\n", corpora[c].name);
+            FreeHT(ht);
+            free(data);
+            return 1;
+        }
+
+        double ratio = (double)result.compressed / size;
+        long peak = 0;
+        for (int i = 0; i < 4; i++)
+            peak = result.grown[i] > peak ? result.grown[i] : peak;
+        if (csv)
+            printf("%s,%zu,%zu,%.4f,%.1f,%.1f,%.1f,%.1f,%.0f,%.0f,%ld,%ld,%ld,%ld,%ld\n", corpora[c].name, size,
+                   result.compressed, ratio, result.encode, result.decode, result.fileencode, result.filedecode,
+                   result.buildmean, result.buildmin, result.rss, result.grown[0], result.grown[1], result.grown[2],
+                   result.grown[3]);
+        else
+            printf("%-10s %8.4f %10.1f %10.1f %10.1f %10.1f %10.0f %10.0f %10ld\n", corpora[c].name, ratio,
+                   result.encode, result.decode, result.fileencode, result.filedecode, result.buildmean,
+                   result.buildmin, peak);
+    }
+    FreeHT(ht);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "ht.h"
+
+#define MAXTHREADS 256
+#define MAXBUFFERED (64 << 20) // larger files are streamed through stdio instead of held in the worker's buffers
+
+/// @brief Files queued for one worker: the owner takes from the back, idle workers steal from the front
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t head, tail; // the queued files are paths[head] to paths[tail - 1]
+} Deque;
+
+typedef struct Batch Batch;
+
+/// @brief A worker thread and the buffers it reuses for every file it codes
+typedef struct
+{
+    Batch *batch;
+    int id;
+    Deque deque;
+    unsigned char *in, *out; // grown to the largest file seen, never shrunk
+    size_t incap, outcap;
+    uint64_t bytesin, bytesout;
+    size_t done, failed;
+    pthread_t thread;
+} Worker;
+
+/// @brief The files of one run and the workers coding them
+struct Batch
+{
+    char **paths;
+    size_t count;
+    bool decompress;
+    unsigned int flags; // HT_ flags to compress with
+    Worker *workers;
+    int nworkers;
+};
+
+/// @brief Current time of the monotonic clock
+/// @return time in seconds
+double NowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// @brief Grows a worker buffer to at least n bytes. The old contents are not kept
+/// @param buffer The buffer
+/// @param cap Its size
+/// @param n Bytes needed
+/// @return 0 if successful, -1 if out of memory
+int Reserve(unsigned char **buffer, size_t *cap, size_t n)
+{
+    if (n <= *cap && *buffer != NULL)
+        return 0;
+    free(*buffer);
+    *buffer = (unsigned char *)malloc(n == 0 ? 1 : n);
+    *cap = *buffer == NULL ? 0 : n;
+    return *buffer == NULL ? -1 : 0;
+}
+
+/// @brief Reads a whole file into a buffer
+/// @param fd The open file
+/// @param buffer Buffer of at least len bytes
+/// @param len Size of the file
+/// @return 0 if successful, -1 if the file could not be read or got shorter
+int ReadAll(int fd, unsigned char *buffer, size_t len)
+{
+    for (size_t pos = 0; pos < len;)
+    {
+        ssize_t n = read(fd, buffer + pos, len - pos);
+        if (n <= 0)
+            return -1;
+        pos += n;
+    }
+    return 0;
+}
+
+/// @brief Writes a buffer to a file, created or truncated
+/// @param path The file
+/// @param buffer The bytes
+/// @param len Number of bytes
+/// @return 0 if successful, -1 on failure
+int WriteAll(const char *path, const unsigned char *buffer, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int status = fd < 0 ? -1 : 0;
+
+    for (size_t pos = 0; pos < len && status == 0;)
+    {
+        ssize_t n = write(fd, buffer + pos, len - pos);
+        if (n <= 0)
+            status = -1;
+        else
+            pos += n;
+    }
+    if (fd >= 0 && close(fd) != 0)
+        status = -1;
+    return status;
+}
+
+/// @brief Codes a file too large for the worker buffers a block at a time through stdio
+/// @param batch The run
+/// @param path The file to code
+/// @param outpath The file to write
+/// @return 0 if successful, -1 on failure
+int StreamFile(const Batch *batch, const char *path, const char *outpath)
+{
+    FILE *input = fopen(path, "rb"), *output = fopen(outpath, "wb");
+    int status = -1;
+
+    // the other workers keep the processors busy, so each file gets a single thread
+    if (input != NULL && output != NULL)
+        status = batch->decompress ? ReadBlocksFromFile(input, output, 1)
+                                   : WriteBlocksToFile(input, output, HT_BLOCKSIZE, 1, batch->flags);
+    if (input != NULL)
+        fclose(input);
+    if (output != NULL && fclose(output) != 0)
+        status = -1;
+    return status;
+}
+
+/// @brief Compresses path to path.hf, or decompresses path.hf to path.u, in the worker's buffers
+/// @param worker The worker
+/// @param path The file to code
+/// @return 0 if successful, -1 on failure
+int CodeFile(Worker *worker, const char *path)
+{
+    const Batch *batch = worker->batch;
+    char outpath[PATH_MAX];
+    size_t len = strlen(path);
+    struct stat info;
+    long size = -1;
+    int fd;
+
+    if (batch->decompress && len > 3 && strcmp(path + len - 3, ".hf") == 0)
+        len -= 3;
+    if (snprintf(outpath, sizeof(outpath), "%.*s%s", (int)len, path, batch->decompress ? ".u" : ".hf") >=
+        (int)sizeof(outpath))
+        return -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &info) != 0 || info.st_size > MAXBUFFERED)
+    {
+        close(fd);
+        if (StreamFile(batch, path, outpath) != 0 || stat(outpath, &info) != 0)
+            return -1;
+        worker->bytesout += info.st_size;
+        if (stat(path, &info) == 0)
+            worker->bytesin += info.st_size;
+        return 0;
+    }
+
+    len = (size_t)info.st_size;
+    if (Reserve(&worker->in, &worker->incap, len) != 0 || ReadAll(fd, worker->in, len) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (batch->decompress)
+    {
+        long rawsize = GetDecompressedSize(worker->in, len);
+        if (rawsize >= 0 && Reserve(&worker->out, &worker->outcap, (size_t)rawsize) == 0)
+            size = ReadBlocksFromBuffer(worker->in, len, worker->out, worker->outcap);
+    }
+    else if (Reserve(&worker->out, &worker->outcap, GetCompressBound(len)) == 0)
+        size = WriteBlocksToBuffer(worker->in, len, worker->out, worker->outcap, batch->flags);
+    if (size < 0 || WriteAll(outpath, worker->out, (size_t)size) != 0)
+        return -1;
+    worker->bytesin += len;
+    worker->bytesout += size;
+    return 0;
+}
+
+/// @brief Takes the next file for a worker: the last one queued for it, else the first one queued
+/// for another worker
+/// @param worker The worker
+/// @param file Set to the index of the file
+/// @return true if a file was taken, false once every queue is empty
+bool TakeFile(Worker *worker, size_t *file)
+{
+    Batch *batch = worker->batch;
+
+    for (int i = 0; i < batch->nworkers; i++)
+    {
+        Deque *deque = &batch->workers[(worker->id + i) % batch->nworkers].deque;
+        bool taken = false;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail)
+        {
+            *file = i == 0 ? --deque->tail : deque->head++;
+            taken = true;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (taken)
+            return true;
+    }
+    return false; // files are never queued after the start, so an empty pass means all are taken
+}
+
+/// @brief Thread body of a worker: codes files until none are left
+/// @param arg The Worker
+/// @return NULL
+void *RunWorker(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    size_t file;
+
+    while (TakeFile(worker, &file))
+    {
+        const char *path = worker->batch->paths[file];
+        if (CodeFile(worker, path) == 0)
+            worker->done++;
+        else
+        {
+            printf("Cannot %s %s!\n", worker->batch->decompress ? "decompress" : "compress", path);
+            worker->failed++;
+        }
+    }
+    return NULL;
+}
+
+/// @brief Appends a copy of a path to the path array
+/// @param path The path
+/// @param paths The path array, grown as needed
+/// @param count Number of paths in the array
+/// @param cap Size of the array
+/// @return 0 if successful, -1 if out of memory, the array left as it was
+int AddPath(const char *path, char ***paths, size_t *count, size_t *cap)
+{
+    char *copy;
+
+    if (*count == *cap)
+    {
+        size_t grownsize = *cap == 0 ? 1024 : 2 * *cap;
+        char **grown = (char **)realloc(*paths, grownsize * sizeof(char *));
+        if (grown == NULL)
+            return -1;
+        *paths = grown;
+        *cap = grownsize;
+    }
+    if ((copy = strdup(path)) == NULL)
+        return -1;
+    (*paths)[(*count)++] = copy;
+    return 0;
+}
+
+/// @brief Frees the path array and its paths
+/// @param paths The path array
+/// @param count Number of paths in the array
+void FreePaths(char **paths, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+/// @brief Reads a list of paths, one per line
+/// @param input The list
+/// @param paths The path array, grown as needed
+/// @param count Number of paths in the array
+/// @param cap Size of the array
+/// @return 0 if successful, -1 if out of memory
+int ReadPathList(FILE *input, char ***paths, size_t *count, size_t *cap)
+{
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t n;
+
+    while ((n = getline(&line, &linecap, input)) > 0)
+    {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+        if (AddPath(line, paths, count, cap) != 0)
+        {
+            free(line);
+            return -1;
+        }
+    }
+    free(line);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    Batch batch = {0};
+    size_t cap = 0;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool fromstdin = false, usage = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0)
+            batch.decompress = true;
+        else if (strcmp(argv[i], "-i") == 0)
+            batch.flags |= HT_INTERLEAVE;
+        else if (strcmp(argv[i], "-k") == 0)
+            batch.flags |= HT_CHECKSUM;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            nthreads = atol(argv[++i]);
+        else if (strcmp(argv[i], "-") == 0)
+            fromstdin = true;
+        else if (argv[i][0] == '-')
+            usage = true;
+        else if (AddPath(argv[i], &batch.paths, &batch.count, &cap) != 0)
+        {
+            printf("Out of memory!\n");
+            FreePaths(batch.paths, batch.count);
+            return 1;
+        }
+    }
+    if (usage || nthreads < 1)
+    {
+        printf("usage: %s [-d] [-i] [-k] [-t threads] [paths... | -]\n", argv[0]);
+        printf("  compresses each path to path.hf, or with -d decompresses path.hf to path.u\n");
+        printf("  -i  compress with HT_INTERLEAVE\n  -k  compress with HT_CHECKSUM\n  -   also read paths from stdin, one per line (the default without paths)\n");
+        FreePaths(batch.paths, batch.count);
+        return 1;
+    }
+    if ((fromstdin || batch.count == 0) && ReadPathList(stdin, &batch.paths, &batch.count, &cap) != 0)
+    {
+        printf("Out of memory!\n");
+        FreePaths(batch.paths, batch.count);
+        return 1;
+    }
+    if (batch.count == 0)
+        return 0;
+
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+    if ((size_t)nthreads > batch.count)
+        nthreads = (long)batch.count;
+    batch.nworkers = (int)nthreads;
+    batch.workers = (Worker *)calloc(batch.nworkers, sizeof(Worker));
+    if (batch.workers == NULL)
+    {
+        printf("Out of memory!\n");
+        FreePaths(batch.paths, batch.count);
+        return 1;
+    }
+
+    // each worker starts with an even share of the files, in order
+    double start = NowSeconds();
+    for (int i = 0; i < batch.nworkers; i++)
+    {
+        Worker *worker = &batch.workers[i];
+        worker->batch = &batch;
+        worker->id = i;
+        worker->deque.head = batch.count * i / batch.nworkers;
+        worker->deque.tail = batch.count * (i + 1) / batch.nworkers;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+    }
+    for (int i = 0; i < batch.nworkers; i++)
+    {
+        if (pthread_create(&batch.workers[i].thread, NULL, RunWorker, &batch.workers[i]) != 0)
+            RunWorker(&batch.workers[i]); // the thread's files are still coded, on this thread
+        else
+            continue;
+        batch.workers[i].thread = pthread_self();
+    }
+
+    uint64_t bytesin = 0, bytesout = 0;
+    size_t done = 0, failed = 0;
+    for (int i = 0; i < batch.nworkers; i++)
+    {
+        Worker *worker = &batch.workers[i];
+        if (!pthread_equal(worker->thread, pthread_self()))
+            pthread_join(worker->thread, NULL);
+        bytesin += worker->bytesin;
+        bytesout += worker->bytesout;
+        done += worker->done;
+        failed += worker->failed;
+        pthread_mutex_destroy(&worker->deque.lock);
+        free(worker->in);
+        free(worker->out);
+    }
+    double elapsed = NowSeconds() - start;
+
+    printf("%zu files, %zu failed, %llu -> %llu bytes in %.2f s (%.1f MB/s) on %d threads\n", done + failed, failed,
+           (unsigned long long)bytesin, (unsigned long long)bytesout, elapsed,
+           elapsed > 0 ? bytesin / elapsed / 1e6 : 0.0, batch.nworkers);
+
+    FreePaths(batch.paths, batch.count);
+    free(batch.workers);
+    return failed == 0 ? 0 : 1;
+}
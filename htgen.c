@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "ht.h"
+
+#define MAXNAME 64
+
+/// @brief What the generator builds the code from
+typedef enum
+{
+    INPUT_SAMPLES,     // bytes of sample data, counted
+    INPUT_FREQUENCIES, // text list of "value count" lines
+    INPUT_TABLE        // code lengths written by WriteCompressedTreeToFile
+} InputKind;
+
+/// @brief The fixed code the source is generated for
+typedef struct
+{
+    unsigned int codes[HT_BYTEVALUES];     // code of each byte value, first bit in the LSB
+    unsigned char lengths[HT_BYTEVALUES];  // code length of each byte value, 0 if it has no code
+    unsigned char maxlength;         // longest code, bits indexing the decode table
+    bool complete;                   // the codes fill the code space, so every table slot decodes
+    int symbols;                     // byte values with a code
+} FixedCode;
+
+/// @brief Counts the bytes of a sample file
+/// @param input The samples
+/// @param counts Gets the count of each of the HT_BYTEVALUES byte values
+/// @return 0 if successful, -1 on a read error
+int CountSamples(FILE *input, uint64_t *counts)
+{
+    unsigned char buffer[65536];
+    size_t len;
+
+    while ((len = fread(buffer, sizeof(unsigned char), sizeof(buffer), input)) != 0)
+    {
+        for (size_t i = 0; i < len; i++)
+            counts[buffer[i]]++;
+    }
+    return ferror(input) ? -1 : 0;
+}
+
+/// @brief Reads a frequency list: one "value count" pair per line, the value in decimal or 0x hex.
+/// Blank lines and lines starting with # are skipped, and a value listed twice is summed. The counts
+/// must total below 2^HT_MAXCOUNTBITS, with room for one more of every byte value, which the library
+/// counts in without scaling
+/// @param input The list
+/// @param counts Gets the count of each of the HT_BYTEVALUES byte values
+/// @return 0 if successful, -1 on a malformed line or counts too large
+int ReadFrequencyList(FILE *input, uint64_t *counts)
+{
+    const uint64_t limit = ((uint64_t)1 << HT_MAXCOUNTBITS) - HT_BYTEVALUES;
+    char line[256];
+    uint64_t total = 0;
+    int number = 0;
+
+    while (fgets(line, sizeof(line), input) != NULL)
+    {
+        char *text = line, *end;
+        number++;
+        while (isspace((unsigned char)*text))
+            text++;
+        if (*text == '\0' || *text == '#')
+            continue;
+        unsigned long value = strtoul(text, &end, 0);
+        if (end == text || value >= HT_BYTEVALUES)
+        {
+            fprintf(stderr, "line %d: expected a byte value\n", number);
+            return -1;
+        }
+        text = end;
+        unsigned long long count = strtoull(text, &end, 0);
+        if (end == text)
+        {
+            fprintf(stderr, "line %d: expected a count\n", number);
+            return -1;
+        }
+        if (count >= limit - total)
+        {
+            fprintf(stderr, "line %d: the counts total 2^%d or more\n", number, HT_MAXCOUNTBITS);
+            return -1;
+        }
+        total += count;
+        counts[value] += count;
+    }
+    return ferror(input) ? -1 : 0;
+}
+
+/// @brief Takes the codes of a tree's symbol nodes
+/// @param ht The tree, its codes assigned
+/// @param code Gets the codes
+/// @return 0 if successful, -1 if the tree has fewer than 2 codes or codes longer than HT_MAXCODELEN
+int TakeCodes(const HuffmanTree *ht, FixedCode *code)
+{
+    uint64_t kraft = 0;
+
+    memset(code, 0, sizeof(FixedCode));
+    for (unsigned int i = 0; i < ht->count; i++)
+    {
+        const HuffmanNode *node = &ht->tree[i];
+        if (node->left != HT_NONE)
+            continue;
+        if (node->codelength == 0 || node->codelength > HT_MAXCODELEN)
+            return -1;
+        code->codes[node->value] = node->hcode;
+        code->lengths[node->value] = node->codelength;
+        if (node->codelength > code->maxlength)
+            code->maxlength = node->codelength;
+        kraft += (uint64_t)1 << (HT_MAXCODELEN - node->codelength);
+        code->symbols++;
+    }
+    code->complete = kraft == (uint64_t)1 << HT_MAXCODELEN;
+    return code->symbols < 2 ? -1 : 0;
+}
+
+/// @brief Writes a table of numbers as a static const array, 16 to a line
+/// @param output The source file
+/// @param type C type of the elements
+/// @param name Name of the array
+/// @param size Its size as written in the source
+/// @param values The numbers
+/// @param count Number of values
+void EmitArray(FILE *output, const char *type, const char *name, const char *size, const unsigned int *values,
+               size_t count)
+{
+    fprintf(output, "static const %s %s[%s] = {\n", type, name, size);
+    for (size_t i = 0; i < count; i++)
+        fprintf(output, "%s%u%s", i % 16 == 0 ? "    " : "", values[i], i + 1 == count ? "\n" : i % 16 == 15 ? ",\n" : ", ");
+    fprintf(output, "};\n\n");
+}
+
+/// @brief Writes the source of the fixed codec: the tables and an encoder and decoder with the code's
+/// longest length built in, their hot loops unrolled by as many codes as fit one bit buffer
+/// @param output The source file
+/// @param code The code
+/// @param name Prefix of the generated names
+/// @param source Where the code came from, for the header comment
+/// @return 0 if successful, -1 if the decode table could not be allocated
+int EmitSource(FILE *output, const FixedCode *code, const char *name, const char *source)
+{
+    char upper[MAXNAME + 1], array[MAXNAME + 16], size[MAXNAME + 32];
+    unsigned int values[HT_BYTEVALUES], *table;
+    size_t slots = (size_t)1 << code->maxlength;
+    unsigned int encodeword = 56 / code->maxlength; // codes added to a bit buffer of at most 7 bits
+    unsigned int decodeword = 56 / code->maxlength; // codes in a refilled bit buffer of at least 56 bits
+
+    for (size_t i = 0; i <= strlen(name); i++)
+        upper[i] = (char)toupper((unsigned char)name[i]);
+
+    // every slot whose low bits are a code decodes to it
+    table = (unsigned int *)calloc(slots, sizeof(unsigned int));
+    if (table == NULL)
+        return -1;
+    for (int value = 0; value < HT_BYTEVALUES; value++)
+    {
+        for (size_t high = 0; code->lengths[value] != 0 && high < slots >> code->lengths[value]; high++)
+            table[code->codes[value] | (high << code->lengths[value])] = (unsigned int)value | code->lengths[value] << 8;
+    }
+
+    fprintf(output, "// Generated by htgen from %s. Do not edit\n", source);
+    fprintf(output, "// Fixed code of %d byte values, codes of at most %u bits%s\n", code->symbols, code->maxlength,
+            code->symbols == HT_BYTEVALUES ? "" : ", bytes without a code are rejected");
+    fprintf(output, "//   long %sEncode(const unsigned char *in, size_t len, unsigned char *out, size_t cap);\n", name);
+    fprintf(output, "//   int %sDecode(const unsigned char *in, size_t len, unsigned char *out, size_t count);\n\n", name);
+    fprintf(output, "#include <stddef.h>\n#include <stdint.h>\n#include <string.h>\n\n");
+    fprintf(output, "#define %s_MAXCODELEN %u // longest code, bits indexing the decode table\n", upper, code->maxlength);
+    fprintf(output, "#define %s_ENCODEWORD %u // codes packed between stores of the bit buffer\n", upper, encodeword);
+    fprintf(output, "#define %s_DECODEWORD %u // codes decoded per refill of the bit buffer\n\n", upper, decodeword);
+
+    fprintf(output, "// code of each byte value, first bit in the LSB\n");
+    for (int value = 0; value < HT_BYTEVALUES; value++)
+        values[value] = code->codes[value];
+    snprintf(array, sizeof(array), "%sCodes", name);
+    EmitArray(output, code->maxlength > 8 ? "uint16_t" : "uint8_t", array, "256", values, HT_BYTEVALUES);
+    fprintf(output, "// code length of each byte value, 0 if it has no code\n");
+    for (int value = 0; value < HT_BYTEVALUES; value++)
+        values[value] = code->lengths[value];
+    snprintf(array, sizeof(array), "%sLengths", name);
+    EmitArray(output, "uint8_t", array, "256", values, HT_BYTEVALUES);
+    fprintf(output, "// byte decoded in the low 8 bits and its code length above, for each value of the next bits%s\n",
+            code->complete ? "" : "; 0 length where no code matches");
+    snprintf(array, sizeof(array), "%sTable", name);
+    snprintf(size, sizeof(size), "1 << %s_MAXCODELEN", upper);
+    EmitArray(output, "uint16_t", array, size, table, slots);
+    free(table);
+
+    // encoder: the fast loop stores the whole bit buffer while 8 bytes of room are left
+    fprintf(output, "/// @brief Encodes bytes with the fixed code, LSB first, the last byte padded with zero bits\n");
+    fprintf(output, "/// @param in The bytes\n/// @param len Number of bytes\n/// @param out Buffer for the codes\n");
+    fprintf(output, "/// @param cap Size of out\n/// @return size of the codes in bytes, or -1 if they do not fit%s\n",
+            code->symbols == HT_BYTEVALUES ? "" : " or a byte has no code");
+    fprintf(output, "long %sEncode(const unsigned char *in, size_t len, unsigned char *out, size_t cap)\n{\n", name);
+    fprintf(output, "    uint64_t bits = 0;\n    unsigned int count = 0;\n    size_t i = 0, pos = 0;\n\n");
+    fprintf(output, "    for (; len - i >= %s_ENCODEWORD && cap - pos >= 8; i += %s_ENCODEWORD)\n    {\n", upper, upper);
+    for (unsigned int k = 0; k < encodeword; k++)
+    {
+        if (code->symbols != HT_BYTEVALUES)
+            fprintf(output, "        if (%sLengths[in[i + %u]] == 0)\n            return -1;\n", name, k);
+        fprintf(output, "        bits |= (uint64_t)%sCodes[in[i + %u]] << count;\n", name, k);
+        fprintf(output, "        count += %sLengths[in[i + %u]];\n", name, k);
+    }
+    fprintf(output, "        memcpy(out + pos, &bits, sizeof(bits)); // little endian\n");
+    fprintf(output, "        pos += count >> 3;\n        bits >>= count & ~7u;\n        count &= 7;\n    }\n");
+    fprintf(output, "    for (; i < len; i++)\n    {\n");
+    if (code->symbols != HT_BYTEVALUES)
+        fprintf(output, "        if (%sLengths[in[i]] == 0)\n            return -1;\n", name);
+    fprintf(output, "        bits |= (uint64_t)%sCodes[in[i]] << count;\n        count += %sLengths[in[i]];\n", name, name);
+    fprintf(output, "        for (; count >= 8; count -= 8, bits >>= 8)\n        {\n");
+    fprintf(output, "            if (pos == cap)\n                return -1;\n            out[pos++] = (unsigned char)bits;\n");
+    fprintf(output, "        }\n    }\n");
+    fprintf(output, "    if (count != 0)\n    {\n        if (pos == cap)\n            return -1;\n");
+    fprintf(output, "        out[pos++] = (unsigned char)bits;\n    }\n    return (long)pos;\n}\n\n");
+
+    // decoder: the fast loop refills a word at a time while 8 bytes are left, the tail a byte at a time
+    fprintf(output, "/// @brief Decodes a number of bytes coded by %sEncode\n", name);
+    fprintf(output, "/// @param in The codes\n/// @param len Size of the codes\n/// @param out Buffer for the bytes\n");
+    fprintf(output, "/// @param count Number of bytes to decode\n/// @return 0 if successful, -1 if the codes are malformed or run out\n");
+    fprintf(output, "int %sDecode(const unsigned char *in, size_t len, unsigned char *out, size_t count)\n{\n", name);
+    fprintf(output, "    uint64_t bits = 0;\n    unsigned int avail = 0;\n    size_t i = 0, pos = 0;\n\n");
+    fprintf(output, "    for (; count - i >= %s_DECODEWORD && len - pos >= 8; i += %s_DECODEWORD)\n    {\n", upper, upper);
+    fprintf(output, "        uint64_t word, entry;\n        memcpy(&word, in + pos, sizeof(word));\n");
+    fprintf(output, "        bits |= word << avail; // bytes past the counted ones are loaded again next time\n");
+    fprintf(output, "        pos += (63 - avail) >> 3;\n        avail |= 56;\n");
+    for (unsigned int k = 0; k < decodeword; k++)
+    {
+        fprintf(output, "        entry = %sTable[bits & ((1u << %s_MAXCODELEN) - 1)];\n", name, upper);
+        if (!code->complete)
+            fprintf(output, "        if (entry >> 8 == 0)\n            return -1;\n");
+        fprintf(output, "        out[i + %u] = (unsigned char)entry;\n", k);
+        fprintf(output, "        bits >>= entry >> 8;\n        avail -= (unsigned int)(entry >> 8);\n");
+    }
+    fprintf(output, "    }\n");
+    fprintf(output, "    for (; i < count; i++)\n    {\n");
+    fprintf(output, "        for (; avail <= 56 && pos < len; avail += 8)\n            bits |= (uint64_t)in[pos++] << avail;\n");
+    fprintf(output, "        uint64_t entry = %sTable[bits & ((1u << %s_MAXCODELEN) - 1)];\n", name, upper);
+    fprintf(output, "        if (%sentry >> 8 > avail)\n            return -1;\n", code->complete ? "" : "entry >> 8 == 0 || ");
+    fprintf(output, "        out[i] = (unsigned char)entry;\n");
+    fprintf(output, "        bits >>= entry >> 8;\n        avail -= (unsigned int)(entry >> 8);\n    }\n");
+    fprintf(output, "    return 0;\n}\n");
+    return ferror(output) ? -1 : 0;
+}
+
+/// @brief Checks a prefix can start C identifiers
+/// @param name The prefix
+/// @return true if it is a C identifier of at most MAXNAME characters
+bool IsIdentifier(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len == 0 || len > MAXNAME || isdigit((unsigned char)name[0]))
+        return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = "HTFixed", *inpath = NULL, *outpath = NULL;
+    InputKind kind = INPUT_SAMPLES;
+    int maxlength = 12;
+    bool exact = false, usage = false;
+    uint64_t counts[HT_BYTEVALUES] = {0};
+    HuffmanTree *ht = NULL;
+    FixedCode code;
+    FILE *input, *output = stdout;
+    int status = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            name = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            maxlength = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0)
+            kind = INPUT_FREQUENCIES;
+        else if (strcmp(argv[i], "-t") == 0)
+            kind = INPUT_TABLE;
+        else if (strcmp(argv[i], "-x") == 0)
+            exact = true;
+        else if (argv[i][0] == '-')
+            usage = true;
+        else if (inpath == NULL)
+            inpath = argv[i];
+        else if (outpath == NULL)
+            outpath = argv[i];
+        else
+            usage = true;
+    }
+    if (usage || inpath == NULL || !IsIdentifier(name) || maxlength < 8 || maxlength > HT_MAXCODELEN)
+    {
+        printf("usage: %s [-n name] [-l maxbits] [-f | -t] [-x] input [output.c]\n", argv[0]);
+        printf("  writes C source with static const tables and an encoder and decoder for one fixed code\n");
+        printf("  input is sample data by default, whose bytes are counted\n");
+        printf("  -n  prefix of the generated names (HTFixed)\n");
+        printf("  -l  longest code, 8 to %d bits (12); the decode table has 2^maxbits entries\n", HT_MAXCODELEN);
+        printf("  -f  input is a frequency list, one \"value count\" line per byte value\n");
+        printf("  -t  input is a table written by WriteCompressedTreeToFile, used as it is\n");
+        printf("  -x  give no code to bytes with a count of 0, instead of counting every byte once more\n");
+        return 1;
+    }
+
+    input = fopen(inpath, kind == INPUT_FREQUENCIES ? "r" : "rb");
+    if (input == NULL)
+    {
+        printf("Cannot open %s!\n", inpath);
+        return 1;
+    }
+    if (kind == INPUT_TABLE)
+        ht = ReadCompressedTreeFromFile(input);
+    else if ((kind == INPUT_SAMPLES ? CountSamples(input, counts) : ReadFrequencyList(input, counts)) == 0)
+    {
+        // as with a trained dictionary, every byte value is counted once more than it was seen so any
+        // input can be coded
+        for (int value = 0; value < HT_BYTEVALUES && !exact; value++)
+            counts[value]++;
+        ht = InitHT();
+        if (ht != NULL)
+        {
+            if (InitializeLeafNodesFromCounts(counts, ht) != 0 || BuildHTFromFrequencies(ht, (unsigned char)maxlength) != 0)
+            {
+                FreeHT(ht);
+                ht = NULL;
+            }
+        }
+    }
+    fclose(input);
+    if (ht == NULL || TakeCodes(ht, &code) != 0)
+    {
+        printf("Cannot build a code of at least 2 symbols from %s!\n", inpath);
+        if (ht != NULL)
+            FreeHT(ht);
+        return 1;
+    }
+    FreeHT(ht);
+
+    if (outpath != NULL)
+        output = fopen(outpath, "w");
+    if (output == NULL || EmitSource(output, &code, name, inpath) != 0)
+    {
+        printf("Cannot write %s!\n", outpath != NULL ? outpath : "the source");
+        status = 1;
+    }
+    if (output != NULL && output != stdout && fclose(output) != 0)
+        status = 1;
+    return status;
+}
@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../ht.h"
+
+#define SMALLBLOCK HT_MINBLOCKSIZE // block size of the file tests, so a few KB make several blocks
+#define WIDEBLOCK (1 << 19)        // symbols per block of the wide codec
+#define FEEDSIZE 1000              // input bytes per FeedHTStream call
+#define DRAINSIZE 777              // output room per FeedHTStream call
+#define FLIPSIZE 3000              // size of the inputs whose containers get every bit flipped
+#define UNINDEXED (16 + 8)         // index entry and trailer of a one block container, which may end without them
+
+/// @brief The inputs every round trip is run on
+typedef enum
+{
+    DATA_TEXT,    // a few symbols with skewed counts
+    DATA_UNIFORM, // every byte value equally likely, stored raw
+    DATA_SINGLE,  // one repeated byte, stored as RLE or coded with a 1 bit code
+    DATA_DEEP,    // byte i repeated fib(i) times, whose tree is deeper than HT_MAXCODELEN
+    DATA_KINDS
+} DataKind;
+
+static const char *kindNames[DATA_KINDS] = {"text", "uniform", "single", "deep"};
+
+/// @brief Bytes carried between a pipe and memory on another thread
+typedef struct
+{
+    int fd;
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} PipeCopy;
+
+static int failures = 0;
+static int checks = 0;
+
+#pragma region Helpers
+
+/// @brief xorshift64*, so every run tests the same bytes
+/// @param state Generator state, not 0
+/// @return the next value
+uint64_t NextRandom(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/// @brief Fills a buffer with one kind of input
+/// @param kind The kind of input
+/// @param data Buffer to fill
+/// @param len Size of data
+void MakeData(DataKind kind, unsigned char *data, size_t len)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    uint64_t a = 1, b = 1, run = 0;
+    unsigned char symbol = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        switch (kind)
+        {
+        case DATA_TEXT:
+            data[i] = "eeeeeeeetttttaaaoinnshr \n"[NextRandom(&state) % 25];
+            break;
+        case DATA_UNIFORM:
+            data[i] = (unsigned char)(NextRandom(&state) >> 56);
+            break;
+        case DATA_SINGLE:
+            data[i] = 'a';
+            break;
+        default:
+            if (run == a)
+            { // the next symbol gets the next fibonacci count
+                uint64_t next = a + b;
+                a = b;
+                b = next;
+                run = 0;
+                symbol++;
+            }
+            data[i] = symbol;
+            run++;
+            break;
+        }
+    }
+}
+
+/// @brief Counts a check and reports it if it failed
+/// @param ok Whether the check passed
+/// @param test Name of the test
+/// @param kind Kind of the input, DATA_KINDS for none
+/// @param len Size of the input
+void Check(bool ok, const char *test, DataKind kind, size_t len)
+{
+    checks++;
+    if (ok)
+        return;
+    failures++;
+    printf("FAIL %s %s %zu\n", test, kind < DATA_KINDS ? kindNames[kind] : "-", len);
+}
+
+/// @brief Makes a temporary file holding bytes, positioned at its start
+/// @param data The bytes
+/// @param len Number of bytes
+/// @return the file, or NULL on failure
+FILE *FileOf(const void *data, size_t len)
+{
+    FILE *file = tmpfile();
+    if (file == NULL)
+        return NULL;
+    if ((len != 0 && fwrite(data, 1, len, file) != len) || fflush(file) != 0)
+    {
+        fclose(file);
+        return NULL;
+    }
+    rewind(file);
+    return file;
+}
+
+/// @brief Reads a whole file back into memory
+/// @param file The file
+/// @param len Set to its size
+/// @return its bytes, to be freed, or NULL on failure
+unsigned char *ReadAll(FILE *file, size_t *len)
+{
+    unsigned char *data = NULL;
+    long size;
+
+    if (fflush(file) != 0 || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0)
+        return NULL;
+    rewind(file);
+    data = (unsigned char *)malloc((size_t)size + 1);
+    if (data != NULL && fread(data, 1, (size_t)size, file) != (size_t)size)
+    {
+        free(data);
+        return NULL;
+    }
+    *len = (size_t)size;
+    return data;
+}
+
+/// @brief Whether a file holds exactly the given bytes
+/// @param file The file
+/// @param data The bytes
+/// @param len Number of bytes
+/// @return true if they match
+bool FileEquals(FILE *file, const unsigned char *data, size_t len)
+{
+    size_t size = 0;
+    unsigned char *read = ReadAll(file, &size);
+    bool same = read != NULL && size == len && (len == 0 || memcmp(read, data, len) == 0);
+    free(read);
+    return same;
+}
+
+/// @brief Writes a buffer into a pipe and closes it
+/// @param arg The PipeCopy
+/// @return NULL
+void *FillPipe(void *arg)
+{
+    PipeCopy *copy = (PipeCopy *)arg;
+    for (size_t done = 0; done < copy->len;)
+    {
+        ssize_t n = write(copy->fd, copy->data + done, copy->len - done);
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    close(copy->fd);
+    return NULL;
+}
+
+/// @brief Reads a pipe to its end into a growing buffer
+/// @param arg The PipeCopy
+/// @return NULL
+void *DrainPipe(void *arg)
+{
+    PipeCopy *copy = (PipeCopy *)arg;
+    for (;;)
+    {
+        if (copy->cap - copy->len < 65536)
+        {
+            unsigned char *grown = (unsigned char *)realloc(copy->data, copy->cap * 2 + 65536);
+            if (grown == NULL)
+                break;
+            copy->data = grown;
+            copy->cap = copy->cap * 2 + 65536;
+        }
+        ssize_t n = read(copy->fd, copy->data + copy->len, copy->cap - copy->len);
+        if (n <= 0)
+            break;
+        copy->len += (size_t)n;
+    }
+    close(copy->fd);
+    return NULL;
+}
+
+/// @brief Runs one whole container through an HTStream, FEEDSIZE bytes in and DRAINSIZE bytes out per call
+/// @param hs The stream context
+/// @param in The input
+/// @param len Size of the input
+/// @param out Buffer for the output
+/// @param cap Size of out
+/// @return size of the output, or -1 if a call failed or the container did not end
+long RunStream(HTStream *hs, const unsigned char *in, size_t len, unsigned char *out, size_t cap)
+{
+    size_t inpos = 0, outpos = 0;
+    int status = 0;
+
+    while (status != HT_STREAMEND)
+    {
+        size_t inlen = len - inpos < FEEDSIZE ? len - inpos : FEEDSIZE;
+        size_t outlen = cap - outpos < DRAINSIZE ? cap - outpos : DRAINSIZE;
+        size_t consumed, produced;
+
+        status = FeedHTStream(hs, in + inpos, inlen, &consumed, out + outpos, outlen, &produced,
+                              inpos + inlen == len ? HT_FINISH : HT_RUN);
+        if (status < 0 || (consumed == 0 && produced == 0 && status != HT_STREAMEND))
+            return -1;
+        inpos += consumed;
+        outpos += produced;
+    }
+    return inpos == len ? (long)outpos : -1;
+}
+
+#pragma endregion Helpers
+
+#pragma region Round trips
+
+/// @brief WriteBlocksToBuffer and ReadBlocksFromBuffer
+void TestBuffer(DataKind kind, const unsigned char *data, size_t len, unsigned int flags)
+{
+    size_t bound = GetCompressBound(len);
+    unsigned char *packed = (unsigned char *)malloc(bound);
+    unsigned char *unpacked = (unsigned char *)malloc(len + 1);
+    long size = WriteBlocksToBuffer(data, len, packed, bound, flags);
+
+    Check(size > 0 && GetDecompressedSize(packed, (size_t)size) == (long)len, "buffer size", kind, len);
+    Check(size > 0 && ReadBlocksFromBuffer(packed, (size_t)size, unpacked, len) == (long)len &&
+              (len == 0 || memcmp(data, unpacked, len) == 0),
+          "buffer", kind, len);
+    if (len > 0 && size > 0)
+        Check(ReadBlocksFromBuffer(packed, (size_t)size, unpacked, len - 1) == -1, "buffer cap", kind, len);
+    free(packed);
+    free(unpacked);
+}
+
+/// @brief WriteBlocksToFile and ReadBlocksFromFile through seekable files, then ReadRangeFromFile
+void TestFile(DataKind kind, const unsigned char *data, size_t len, unsigned int flags, int nthreads)
+{
+    const size_t offsets[] = {0, 1, SMALLBLOCK - 1, SMALLBLOCK, len / 2, len - 1, len};
+    const size_t lengths[] = {1, SMALLBLOCK + 1, len + 1};
+    unsigned char *range = (unsigned char *)malloc(len + 2);
+    FILE *input = FileOf(data, len), *packed = tmpfile(), *output = tmpfile();
+
+    if (input == NULL || packed == NULL || output == NULL || range == NULL)
+        Check(false, "file setup", kind, len);
+    else
+    {
+        Check(WriteBlocksToFile(input, packed, SMALLBLOCK, nthreads, flags) == 0, "file write", kind, len);
+        rewind(packed);
+        Check(ReadBlocksFromFile(packed, output, nthreads) == 0 && FileEquals(output, data, len), "file", kind, len);
+
+        for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+        {
+            for (size_t j = 0; j < sizeof(lengths) / sizeof(lengths[0]); j++)
+            {
+                size_t offset = offsets[i] > len ? len : offsets[i];
+                size_t want = len - offset < lengths[j] ? len - offset : lengths[j];
+                rewind(packed);
+                long got = ReadRangeFromFile(packed, offset, lengths[j], range);
+                Check(got == (long)want && (want == 0 || memcmp(range, data + offset, want) == 0), "range", kind, len);
+            }
+        }
+    }
+    if (input != NULL)
+        fclose(input);
+    if (packed != NULL)
+        fclose(packed);
+    if (output != NULL)
+        fclose(output);
+    free(range);
+}
+
+/// @brief WriteBlocksToFile into a pipe and ReadBlocksFromFile out of one, neither able to seek
+void TestPipe(DataKind kind, const unsigned char *data, size_t len, unsigned int flags)
+{
+    PipeCopy packed = {0}, fed = {0};
+    pthread_t thread;
+    int fds[2];
+    FILE *input = FileOf(data, len), *output = tmpfile(), *end;
+
+    if (input == NULL || output == NULL || pipe(fds) != 0)
+    {
+        Check(false, "pipe setup", kind, len);
+        return;
+    }
+    packed.fd = fds[0];
+    pthread_create(&thread, NULL, DrainPipe, &packed);
+    end = fdopen(fds[1], "wb");
+    Check(WriteBlocksToFile(input, end, SMALLBLOCK, 2, flags) == 0, "pipe write", kind, len);
+    fclose(end);
+    pthread_join(thread, NULL);
+
+    if (pipe(fds) != 0)
+        Check(false, "pipe setup", kind, len);
+    else
+    {
+        fed.fd = fds[1];
+        fed.data = packed.data;
+        fed.len = packed.len;
+        pthread_create(&thread, NULL, FillPipe, &fed);
+        end = fdopen(fds[0], "rb");
+        Check(ReadBlocksFromFile(end, output, 2) == 0 && FileEquals(output, data, len), "pipe", kind, len);
+        fclose(end);
+        pthread_join(thread, NULL);
+    }
+    free(packed.data);
+    fclose(input);
+    fclose(output);
+}
+
+/// @brief FeedHTStream both ways in small pieces, and the stream's container read as a buffer
+void TestStream(DataKind kind, const unsigned char *data, size_t len, unsigned int flags)
+{
+    size_t bound = GetCompressBound(len) + 64;
+    unsigned char *packed = (unsigned char *)malloc(bound);
+    unsigned char *unpacked = (unsigned char *)malloc(len + 1);
+    HTStream *compressor = InitHTStream(true, flags), *decompressor = InitHTStream(false, 0);
+    long size = RunStream(compressor, data, len, packed, bound);
+
+    Check(size > 0 && RunStream(decompressor, packed, (size_t)size, unpacked, len) == (long)len &&
+              (len == 0 || memcmp(data, unpacked, len) == 0),
+          "stream", kind, len);
+    Check(size > 0 && ReadBlocksFromBuffer(packed, (size_t)size, unpacked, len) == (long)len, "stream buffer", kind,
+          len);
+    FreeHTStream(compressor);
+    FreeHTStream(decompressor);
+    free(packed);
+    free(unpacked);
+}
+
+/// @brief The single tree file codec: InitializeLeafNodes, WriteCompressedTreeToFile and WriteDataToFile,
+/// then ReadCompressedTreeFromFile and ReadDataFromFile
+void TestSingleTree(DataKind kind, const unsigned char *data, size_t len)
+{
+    FILE *input = FileOf(data, len), *packed = tmpfile(), *output = tmpfile();
+    HuffmanTree *ht = InitHT(), *read = NULL;
+
+    if (input == NULL || packed == NULL || output == NULL || ht == NULL)
+        Check(false, "tree setup", kind, len);
+    else
+    {
+        Check(InitializeLeafNodes(input, ht) == 0 && BuildHTFromFrequencies(ht, HT_MAXCODELEN) == 0 &&
+                  WriteCompressedTreeToFile(ht, packed) == 0 && WriteDataToFile(ht, input, packed) == 0,
+              "tree write", kind, len);
+        rewind(packed);
+        read = ReadCompressedTreeFromFile(packed);
+        Check(read != NULL && ReadDataFromFile(read, packed, output) == 0 && FileEquals(output, data, len), "tree", kind,
+              len);
+    }
+    if (input != NULL)
+        fclose(input);
+    if (packed != NULL)
+        fclose(packed);
+    if (output != NULL)
+        fclose(output);
+    if (ht != NULL)
+        FreeHT(ht);
+    if (read != NULL)
+        FreeHT(read);
+}
+
+/// @brief CompressHTWide and DecompressHTWide, over a small and the full alphabet
+void TestWide(DataKind kind, const unsigned char *data, size_t count)
+{
+    const unsigned int alphabets[] = {300, HT_MAXALPHABET};
+    uint16_t *symbols = (uint16_t *)malloc(count * sizeof(uint16_t) + 2);
+    uint16_t *unpacked = (uint16_t *)malloc(count * sizeof(uint16_t) + 2);
+    size_t bound = GetHTWideBound(count);
+    unsigned char *packed = (unsigned char *)malloc(bound);
+
+    for (int a = 0; a < 2; a++)
+    {
+        HTWide *hw = InitHTWide(alphabets[a]);
+        for (size_t i = 0; i < count; i++)
+            symbols[i] = (uint16_t)((data[i] * 7u + (kind == DATA_UNIFORM ? data[count - 1 - i] : 0)) % alphabets[a]);
+        long size = CompressHTWide(hw, symbols, count, packed, bound);
+        Check(size > 0 && GetHTWideCount(packed, (size_t)size) == (long)count &&
+                  DecompressHTWide(hw, packed, (size_t)size, unpacked, count) == (long)count &&
+                  (count == 0 || memcmp(symbols, unpacked, count * sizeof(uint16_t)) == 0),
+              "wide", kind, count);
+        FreeHTWide(hw);
+    }
+    free(symbols);
+    free(unpacked);
+    free(packed);
+}
+
+/// @brief A dictionary trained on one input, saved, loaded and used on messages cut from another
+void TestDictionary(DataKind kind, const unsigned char *samples, size_t len, const unsigned char *data)
+{
+    const size_t sizes[] = {0, 1, 100, 4096};
+    unsigned char saved[HT_DICTSAVESIZE], packed[HT_DICTBOUND(4096)], unpacked[4096];
+    HTDictionary *trained = TrainHTDictionary(samples, len, 42), *loaded = NULL;
+    long size = trained != NULL ? SaveHTDictionary(trained, saved, sizeof(saved)) : -1;
+
+    Check(size > 0 && (loaded = LoadHTDictionary(saved, (size_t)size)) != NULL, "dictionary load", kind, len);
+    for (size_t i = 0; loaded != NULL && i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        long packedsize = CompressWithHTDictionary(trained, data, sizes[i], packed, sizeof(packed));
+        Check(packedsize > 0 && GetHTDictionaryID(packed, (size_t)packedsize) == 42 &&
+                  DecompressWithHTDictionary(loaded, packed, (size_t)packedsize, unpacked, sizeof(unpacked)) ==
+                      (long)sizes[i] &&
+                  (sizes[i] == 0 || memcmp(data, unpacked, sizes[i]) == 0),
+              "dictionary", kind, sizes[i]);
+    }
+    FreeHTDictionary(trained);
+    FreeHTDictionary(loaded);
+}
+
+#pragma endregion Round trips
+
+#pragma region Rejection
+
+/// @brief Every cut of a container but the one at its end marker must fail, and every flipped bit of a
+/// checksummed one must fail or change nothing
+void TestDamagedContainers(const unsigned char *data)
+{
+    size_t bound = GetCompressBound(FLIPSIZE);
+    unsigned char *packed = (unsigned char *)malloc(bound);
+    unsigned char *unpacked = (unsigned char *)malloc(FLIPSIZE);
+    long size = WriteBlocksToBuffer(data, FLIPSIZE, packed, bound, HT_CHECKSUM | HT_INTERLEAVE);
+    HTStream *decompressor = InitHTStream(false, 0);
+    bool cuts = true, flips = true, streamcuts = true;
+
+    for (long cut = 0; cut < size; cut++)
+    {
+        bool whole = cut == size - UNINDEXED;
+        long expect = whole ? FLIPSIZE : -1;
+        cuts &= ReadBlocksFromBuffer(packed, (size_t)cut, unpacked, FLIPSIZE) == expect &&
+                GetDecompressedSize(packed, (size_t)cut) == expect;
+        streamcuts &= whole || RunStream(decompressor, packed, (size_t)cut, unpacked, FLIPSIZE) == -1;
+        ResetHTStream(decompressor);
+    }
+    Check(size > 0 && cuts, "cut buffer", DATA_KINDS, FLIPSIZE);
+    Check(size > 0 && streamcuts, "cut stream", DATA_KINDS, FLIPSIZE);
+    FreeHTStream(decompressor);
+
+    for (long bit = 0; bit < size * 8; bit++)
+    {
+        packed[bit / 8] ^= (unsigned char)(1 << bit % 8);
+        long got = ReadBlocksFromBuffer(packed, (size_t)size, unpacked, FLIPSIZE);
+        flips &= got == -1 || (got == FLIPSIZE && memcmp(data, unpacked, FLIPSIZE) == 0);
+        packed[bit / 8] ^= (unsigned char)(1 << bit % 8);
+    }
+    Check(size > 0 && flips, "flip buffer", DATA_KINDS, FLIPSIZE);
+
+    // the same through files, cut at every block header and inside the blocks
+    FILE *input = FileOf(data, FLIPSIZE), *file = tmpfile();
+    size_t filesize = 0;
+    unsigned char *container = NULL;
+    cuts = flips = true;
+    if (input != NULL && file != NULL && WriteBlocksToFile(input, file, SMALLBLOCK, 2, HT_CHECKSUM) == 0)
+        container = ReadAll(file, &filesize);
+    for (size_t cut = 0; container != NULL && cut < filesize; cut += 7)
+    {
+        FILE *damaged = FileOf(container, cut), *output = tmpfile();
+        cuts &= damaged != NULL && output != NULL && ReadBlocksFromFile(damaged, output, 2) != 0;
+        fclose(damaged);
+        fclose(output);
+    }
+    Check(container != NULL && cuts, "cut file", DATA_KINDS, FLIPSIZE);
+    for (size_t bit = 0; container != NULL && bit < filesize * 8; bit += 5)
+    {
+        container[bit / 8] ^= (unsigned char)(1 << bit % 8);
+        FILE *damaged = FileOf(container, filesize), *output = tmpfile();
+        flips &= damaged != NULL && output != NULL &&
+                 (ReadBlocksFromFile(damaged, output, 2) != 0 || FileEquals(output, data, FLIPSIZE));
+        fclose(damaged);
+        fclose(output);
+        container[bit / 8] ^= (unsigned char)(1 << bit % 8);
+    }
+    Check(container != NULL && flips, "flip file", DATA_KINDS, FLIPSIZE);
+
+    if (input != NULL)
+        fclose(input);
+    if (file != NULL)
+        fclose(file);
+    free(container);
+    free(packed);
+    free(unpacked);
+}
+
+/// @brief Cut or flipped dictionaries must not load, and cut messages must not decode
+void TestDamagedDictionaries(const unsigned char *data)
+{
+    unsigned char saved[HT_DICTSAVESIZE], packed[HT_DICTBOUND(FLIPSIZE)], unpacked[FLIPSIZE];
+    HTDictionary *dict = TrainHTDictionary(data, FLIPSIZE, 7);
+    long size = dict != NULL ? SaveHTDictionary(dict, saved, sizeof(saved)) : -1;
+    long packedsize = dict != NULL ? CompressWithHTDictionary(dict, data, FLIPSIZE, packed, sizeof(packed)) : -1;
+    bool cuts = true, flips = true;
+
+    for (long cut = 0; cut < size; cut++)
+    {
+        HTDictionary *loaded = LoadHTDictionary(saved, (size_t)cut);
+        cuts &= loaded == NULL;
+        FreeHTDictionary(loaded);
+    }
+    Check(size > 0 && cuts, "cut dictionary", DATA_KINDS, (size_t)size);
+
+    // the id is the only field a flip can leave loadable, every code length change breaks the code
+    for (long bit = 0; bit < size * 8; bit++)
+    {
+        saved[bit / 8] ^= (unsigned char)(1 << bit % 8);
+        HTDictionary *loaded = LoadHTDictionary(saved, (size_t)size);
+        flips &= loaded == NULL || (bit >= 32 && bit < 64 && GetHTDictionaryID(packed, (size_t)packedsize) == 7 &&
+                                    DecompressWithHTDictionary(loaded, packed, (size_t)packedsize, unpacked,
+                                                               sizeof(unpacked)) == -1);
+        FreeHTDictionary(loaded);
+        saved[bit / 8] ^= (unsigned char)(1 << bit % 8);
+    }
+    Check(size > 0 && flips, "flip dictionary", DATA_KINDS, (size_t)size);
+
+    cuts = true;
+    for (long cut = 0; cut < packedsize; cut++)
+        cuts &= DecompressWithHTDictionary(dict, packed, (size_t)cut, unpacked, sizeof(unpacked)) == -1;
+    Check(packedsize > 0 && cuts, "cut message", DATA_KINDS, FLIPSIZE);
+    FreeHTDictionary(dict);
+}
+
+/// @brief Cut wide containers must not decode, nor RAW and RLE blocks holding symbols outside the alphabet
+void TestDamagedWide(const unsigned char *data)
+{
+    uint16_t symbols[FLIPSIZE], unpacked[FLIPSIZE];
+    unsigned char packed[FLIPSIZE * 2 + 64];
+    HTWide *hw = InitHTWide(300);
+    long size;
+    bool cuts = true;
+
+    for (size_t i = 0; i < FLIPSIZE; i++)
+        symbols[i] = (uint16_t)(data[i] % 300);
+    size = CompressHTWide(hw, symbols, FLIPSIZE, packed, sizeof(packed));
+    for (long cut = 0; cut < size; cut++)
+        cuts &= DecompressHTWide(hw, packed, (size_t)cut, unpacked, FLIPSIZE) == -1;
+    Check(size > 0 && cuts, "cut wide", DATA_KINDS, FLIPSIZE);
+    for (long bit = 0; bit < size * 8; bit++)
+    { // nothing to check but that no flip runs past a buffer
+        packed[bit / 8] ^= (unsigned char)(1 << bit % 8);
+        DecompressHTWide(hw, packed, (size_t)size, unpacked, FLIPSIZE);
+        packed[bit / 8] ^= (unsigned char)(1 << bit % 8);
+    }
+
+    // a block of one symbol is stored as that symbol (RLE), a block of two as its values (RAW); the
+    // symbols start after the 16 byte container and 9 byte block headers
+    for (size_t count = 1; count <= 2; count++)
+    {
+        symbols[0] = 299;
+        symbols[1] = 298;
+        size = CompressHTWide(hw, symbols, count, packed, sizeof(packed));
+        Check(size > 0 && DecompressHTWide(hw, packed, (size_t)size, unpacked, count) == (long)count, "wide small",
+              DATA_KINDS, count);
+        packed[25] = 300 & 0xFF;
+        packed[26] = 300 >> 8;
+        Check(size > 0 && DecompressHTWide(hw, packed, (size_t)size, unpacked, count) == -1, "wide alphabet",
+              DATA_KINDS, count);
+    }
+    FreeHTWide(hw);
+}
+
+#pragma endregion Rejection
+
+int main(void)
+{
+    const size_t sizes[] = {0, 1, SMALLBLOCK - 1, SMALLBLOCK, SMALLBLOCK + 1, 5 * SMALLBLOCK + 3};
+    const size_t largesizes[] = {HT_BLOCKSIZE - 1, HT_BLOCKSIZE, HT_BLOCKSIZE + 1};
+    const unsigned int flagsets[] = {0, HT_INTERLEAVE, HT_CHECKSUM, HT_INTERLEAVE | HT_CHECKSUM};
+    size_t maxlen = HT_BLOCKSIZE + 1;
+    unsigned char *data = (unsigned char *)malloc(maxlen);
+    unsigned char *text = (unsigned char *)malloc(maxlen);
+
+    if (data == NULL || text == NULL)
+        return 1;
+    MakeData(DATA_TEXT, text, maxlen);
+
+    for (int kind = 0; kind < DATA_KINDS; kind++)
+    {
+        MakeData((DataKind)kind, data, maxlen);
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            for (size_t f = 0; f < sizeof(flagsets) / sizeof(flagsets[0]); f++)
+            {
+                TestBuffer((DataKind)kind, data, sizes[i], flagsets[f]);
+                TestFile((DataKind)kind, data, sizes[i], flagsets[f], 1);
+                TestFile((DataKind)kind, data, sizes[i], flagsets[f], 4);
+                TestPipe((DataKind)kind, data, sizes[i], flagsets[f]);
+                TestStream((DataKind)kind, data, sizes[i], flagsets[f]);
+            }
+            if (sizes[i] > 0)
+                TestSingleTree((DataKind)kind, data, sizes[i]);
+            TestWide((DataKind)kind, data, sizes[i]);
+        }
+        // around the block size of the buffer and stream codecs and the pipelined single tree codec
+        for (size_t i = 0; i < sizeof(largesizes) / sizeof(largesizes[0]); i++)
+        {
+            TestBuffer((DataKind)kind, data, largesizes[i], HT_INTERLEAVE | HT_CHECKSUM);
+            TestStream((DataKind)kind, data, largesizes[i], 0);
+            TestSingleTree((DataKind)kind, data, largesizes[i]);
+        }
+        for (size_t count = WIDEBLOCK - 1; count <= WIDEBLOCK + 1; count++)
+            TestWide((DataKind)kind, data, count);
+        TestDictionary((DataKind)kind, data, FLIPSIZE, text);
+    }
+
+    TestDamagedContainers(text);
+    TestDamagedDictionaries(text);
+    TestDamagedWide(text);
+
+    printf("%d of %d checks failed\n", failures, checks);
+    free(data);
+    free(text);
+    return failures == 0 ? 0 : 1;
+}